@@ -0,0 +1,189 @@
+#include "MMU.h"
+#include "PPU.h"
+#include "SM83.h"
+#include "Timer.h"
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// Micro benchmark of the SM83 interpreter.
+// Usage : cpu_bench [instruction count] [rom path]
+// Without a rom, a tight loop mixing ALU ops, CB rotates and conditional
+// jumps/calls/returns is generated and run from a temporary file.
+// The LCD is left off so the figure mostly reflects the interpreter itself.
+// A rom given on the command line (e.g. blargg's cpu_instrs.gb) is started from
+// its 0x100 entry point by a stub boot rom.
+
+using namespace std::chrono;
+
+static std::vector<u8> make_loop_rom()
+{
+    std::vector<u8> rom(0x8000, 0x00);
+
+    const std::vector<u8> code
+    {
+        0x31, 0xFE, 0xFF, // 0000: LD SP, 0xFFFE
+        0x3C,             // 0003: INC A
+        0x80,             // 0004: ADD A, B
+        0x89,             // 0005: ADC A, C
+        0x92,             // 0006: SUB D
+        0x9B,             // 0007: SBC A, E
+        0xA4,             // 0008: AND H
+        0xAD,             // 0009: XOR L
+        0xB0,             // 000A: OR B
+        0xB9,             // 000B: CP C
+        0xCB, 0x00,       // 000C: RLC B
+        0xCB, 0x19,       // 000E: RR C
+        0xC4, 0x1B, 0x00, // 0010: CALL NZ, 0x001B
+        0x15,             // 0013: DEC D
+        0x20, 0xED,       // 0014: JR NZ, 0x0003
+        0xCA, 0x03, 0x00, // 0016: JP Z, 0x0003
+        0x00,             // 0019: NOP
+        0x00,             // 001A: NOP
+        0xD8,             // 001B: RET C
+        0xC9,             // 001C: RET
+    };
+
+    std::copy(code.begin(), code.end(), rom.begin());
+
+    return rom;
+}
+
+static std::vector<u8> make_boot_rom()
+{
+    std::vector<u8> boot(0x100, 0x00);
+
+    const std::vector<u8> entry
+    {
+        0x31, 0xFE, 0xFF, // 0000: LD SP, 0xFFFE
+        0xC3, 0xFC, 0x00, // 0003: JP 0x00FC
+    };
+
+    const std::vector<u8> unmap
+    {
+        0x3E, 0x01,       // 00FC: LD A, 0x01
+        0xE0, 0x50,       // 00FE: LDH (0x50), A
+    };
+
+    std::copy(entry.begin(), entry.end(), boot.begin());
+    std::copy(unmap.begin(), unmap.end(), boot.begin() + 0xFC);
+
+    return boot;
+}
+
+// Named after the process so concurrent runs don't overwrite each other's files
+static std::string write_temp(const std::string& name, const std::vector<u8>& data)
+{
+#if defined(_WIN32)
+    const int pid = _getpid();
+#else
+    const int pid = getpid();
+#endif
+    auto path = (std::filesystem::temp_directory_path() / fmt::format("pgbe_cpu_bench_{}_{}", pid, name)).string();
+
+    std::ofstream output(path, std::ios::binary);
+    output.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    return path;
+}
+
+struct Machine
+{
+    PGBE::MMU mmu;
+    PGBE::PPU ppu;
+    PGBE::Timer timer;
+    PGBE::SM83 cpu;
+    std::array<PGBE::color, FRAMEBUFFER_SIZE> framebuffer;
+
+    Machine(const std::string& rom_path, const std::string& boot_path) :
+        mmu(),
+        ppu(&mmu),
+        timer(&mmu, &ppu),
+        cpu(&mmu, &timer, &ppu),
+        framebuffer()
+    {
+        mmu.timer = &timer;
+        ppu.framebuffer = &framebuffer;
+        mmu.load_game_rom(rom_path, false);
+
+        if (boot_path.empty())
+        {
+            mmu.write(0xFF00 + PGBE::BANK, 1);
+        }
+        else
+        {
+            mmu.load_boot_rom(boot_path);
+        }
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    const u64 nb_instr = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 20'000'000;
+    std::string rom_path = (argc > 2) ? argv[2] : "";
+    std::string boot_path;
+    std::string temp_path;
+
+    if (rom_path.empty())
+    {
+        rom_path = write_temp("loop.gb", make_loop_rom());
+        temp_path = rom_path;
+    }
+    else
+    {
+        boot_path = write_temp("boot.bin", make_boot_rom());
+        temp_path = boot_path;
+    }
+
+    auto stepped = std::make_unique<Machine>(rom_path, boot_path);
+
+    auto start = steady_clock::now();
+    for (u64 i = 0; i < nb_instr; ++i)
+    {
+        stepped->cpu.run();
+    }
+    auto end = steady_clock::now();
+
+    double elapsed = duration<double>(end - start).count();
+
+    fmt::print("\n{} instructions in {:.3f} s : {:.2f} MIPS\n", nb_instr, elapsed, nb_instr / elapsed / 1'000'000);
+
+    // Same amount of emulated time through the dispatch loop, from a fresh machine
+    auto dispatched = std::make_unique<Machine>(rom_path, boot_path);
+    const u64 nb_cycles = stepped->cpu.cycles();
+
+    start = steady_clock::now();
+    while (dispatched->cpu.cycles() < nb_cycles)
+    {
+        dispatched->cpu.run_for(nb_cycles - dispatched->cpu.cycles());
+        if (dispatched->ppu.frame_completed())
+        {
+            dispatched->ppu.reset();
+        }
+    }
+    end = steady_clock::now();
+
+    elapsed = duration<double>(end - start).count();
+
+    // Halted stretches and idle loops are skipped, only the instructions actually run are counted
+    const u64 nb_dispatched = dispatched->cpu.instructions();
+
+    fmt::print("\n{} M-cycles, {} instructions in {:.3f} s through run_for : {:.2f} MIPS, {:.2f} M-cycles/s\n",
+        nb_cycles, nb_dispatched, elapsed, nb_dispatched / elapsed / 1'000'000, nb_cycles / elapsed / 1'000'000);
+
+    std::filesystem::remove(temp_path);
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include "MMU.h"
+#include "PPU.h"
+#include "SM83.h"
+#include "Timer.h"
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Runs the same rom on the interpreter and on the dynarec, comparing the
+// whole machine state after every slice of a few M-cycles.
+// Usage : dynarec_lockstep [M-cycle count] [rom path]
+// Without a rom, a loop mixing natively translated instructions, memory
+// accesses, calls and timer interrupts is generated. It also copies a routine
+// to WRAM, runs it past the translation threshold and flips one of its opcodes
+// before every call, so stale translated code shows up as a mismatch.
+
+static std::vector<u8> make_lockstep_rom()
+{
+    std::vector<u8> rom(0x8000, 0x00);
+
+    const std::vector<u8> entry
+    {
+        0xC3, 0x00, 0x01, // 0000: JP 0x0100
+    };
+
+    const std::vector<u8> timer_isr
+    {
+        0x1C,             // 0050: INC E
+        0x3C,             // 0051: INC A
+        0xD9,             // 0052: RETI
+    };
+
+    const std::vector<u8> code
+    {
+        0x31, 0xFE, 0xFF, // 0100: LD SP, 0xFFFE
+        0x21, 0x00, 0x02, // 0103: LD HL, 0x0200
+        0x11, 0x00, 0xC1, // 0106: LD DE, 0xC100
+        0x0E, 0x0A,       // 0109: LD C, 0x0A
+        0x2A,             // 010B: LD A, (HL+)
+        0x12,             // 010C: LD (DE), A
+        0x13,             // 010D: INC DE
+        0x0D,             // 010E: DEC C
+        0x20, 0xFA,       // 010F: JR NZ, 0x010B
+        0x16, 0x00,       // 0111: LD D, 0x00
+        0x3E, 0x04,       // 0113: LD A, 0x04
+        0xE0, 0xFF,       // 0115: LDH (IE), A
+        0x3E, 0x05,       // 0117: LD A, 0x05
+        0xE0, 0x07,       // 0119: LDH (TAC), A
+        0xFB,             // 011B: EI
+        0x3C,             // 011C: INC A
+        0x47,             // 011D: LD B, A
+        0x80,             // 011E: ADD A, B
+        0x89,             // 011F: ADC A, C
+        0x0E, 0x37,       // 0120: LD C, 0x37
+        0x92,             // 0122: SUB D
+        0x9B,             // 0123: SBC A, E
+        0xA4,             // 0124: AND H
+        0xAD,             // 0125: XOR L
+        0xB0,             // 0126: OR B
+        0xB9,             // 0127: CP C
+        0xFE, 0x10,       // 0128: CP 0x10
+        0xCE, 0x03,       // 012A: ADC A, 0x03
+        0xDE, 0x41,       // 012C: SBC A, 0x41
+        0xCB, 0x00,       // 012E: RLC B
+        0xCB, 0x19,       // 0130: RR C
+        0x21, 0x00, 0xC0, // 0132: LD HL, 0xC000
+        0x77,             // 0135: LD (HL), A
+        0x2C,             // 0136: INC L
+        0x1D,             // 0137: DEC E
+        0x14,             // 0138: INC D
+        0xC4, 0x4C, 0x01, // 0139: CALL NZ, 0x014C
+        0x15,             // 013C: DEC D
+        0x20, 0xDD,       // 013D: JR NZ, 0x011C
+        0xCD, 0x00, 0xC1, // 013F: CALL 0xC100
+        0x21, 0x02, 0xC1, // 0142: LD HL, 0xC102
+        0x7E,             // 0145: LD A, (HL)
+        0xEE, 0x01,       // 0146: XOR 0x01
+        0x77,             // 0148: LD (HL), A
+        0xC3, 0x1C, 0x01, // 0149: JP 0x011C
+        0xD8,             // 014C: RET C
+        0xC9,             // 014D: RET
+    };
+
+    // Copied to 0xC100, the loop block is translated halfway through each call
+    const std::vector<u8> wram_routine
+    {
+        0x06, 0x20,       // C100: LD B, 0x20
+        0x3C,             // C102: INC A (DEC A every other call)
+        0x83,             // C103: ADD A, E
+        0xA9,             // C104: XOR C
+        0x05,             // C105: DEC B
+        0x20, 0xFA,       // C106: JR NZ, 0xC102
+        0x4F,             // C108: LD C, A
+        0xC9,             // C109: RET
+    };
+
+    std::copy(entry.begin(), entry.end(), rom.begin());
+    std::copy(timer_isr.begin(), timer_isr.end(), rom.begin() + 0x50);
+    std::copy(code.begin(), code.end(), rom.begin() + 0x100);
+    std::copy(wram_routine.begin(), wram_routine.end(), rom.begin() + 0x200);
+
+    return rom;
+}
+
+struct Machine
+{
+    PGBE::MMU mmu;
+    PGBE::PPU ppu;
+    PGBE::Timer timer;
+    PGBE::SM83 cpu;
+    std::array<PGBE::color, FRAMEBUFFER_SIZE> framebuffer;
+
+    Machine(const std::string& rom_path, bool dynarec) :
+        mmu(),
+        ppu(&mmu),
+        timer(&mmu, &ppu),
+        cpu(&mmu, &timer, &ppu),
+        framebuffer()
+    {
+        mmu.timer = &timer;
+        ppu.framebuffer = &framebuffer;
+        mmu.load_game_rom(rom_path, false);
+        mmu.write(0xFF00 + PGBE::BANK, 1);
+        cpu.set_dynarec(dynarec);
+    }
+
+    void run_for(u64 budget)
+    {
+        cpu.run_for(budget);
+        if (ppu.frame_completed())
+        {
+            ppu.reset();
+        }
+    }
+};
+
+static bool same_state(Machine& a, Machine& b)
+{
+    // DIV and TIMA are only counted up to now when accessed
+    a.timer.sync();
+    b.timer.sync();
+
+    return a.cpu.cycles() == b.cpu.cycles()
+        && a.cpu.instructions() == b.cpu.instructions()
+        && a.cpu.dump() == b.cpu.dump()
+        && a.mmu.vram == b.mmu.vram
+        && a.mmu.wram == b.mmu.wram
+        && a.mmu.oam == b.mmu.oam
+        && a.mmu.io_reg == b.mmu.io_reg
+        && a.mmu.hram == b.mmu.hram
+        && a.mmu.ie_reg == b.mmu.ie_reg
+        && std::memcmp(a.framebuffer.data(), b.framebuffer.data(), sizeof(a.framebuffer)) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const u64 nb_cycles = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 5'000'000;
+    std::string rom_path = (argc > 2) ? argv[2] : "";
+    std::string temp_path;
+
+    if (rom_path.empty())
+    {
+        // Named after the process so concurrent runs don't overwrite each other's rom
+        auto rom = make_lockstep_rom();
+        temp_path = (std::filesystem::temp_directory_path() / fmt::format("pgbe_dynarec_lockstep_{}.gb", getpid())).string();
+        rom_path = temp_path;
+
+        std::ofstream output(rom_path, std::ios::binary);
+        output.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+    }
+
+    auto interpreter = std::make_unique<Machine>(rom_path, false);
+    auto dynarec = std::make_unique<Machine>(rom_path, true);
+
+    // Both machines have loaded the rom by now
+    if (!temp_path.empty())
+    {
+        std::filesystem::remove(temp_path);
+    }
+
+    // Slices of varying length so the translated blocks get cut everywhere
+    u64 slice = 1;
+    while (interpreter->cpu.cycles() < nb_cycles)
+    {
+        interpreter->run_for(slice);
+        dynarec->run_for(slice);
+
+        if (!same_state(*interpreter, *dynarec))
+        {
+            fmt::print("State mismatch after {} M-cycles\ninterpreter : {}dynarec     : {}",
+                interpreter->cpu.cycles(), interpreter->cpu.dump(), dynarec->cpu.dump());
+            return 1;
+        }
+
+        slice = (slice * 7 + 3) % 251 + 1;
+    }
+
+    fmt::print("{} M-cycles in lockstep\n", interpreter->cpu.cycles());
+
+    return 0;
+}
\ No newline at end of file
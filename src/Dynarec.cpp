@@ -0,0 +1,121 @@
+#include "Dynarec.h"
+
+#if defined(PGBE_DYNAREC)
+#include <algorithm>
+#include <fmt/core.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace PGBE
+{
+    constexpr std::size_t CODE_BUFFER_SIZE = 16 * 1024 * 1024;
+
+    Dynarec::Dynarec() :
+        m_code(nullptr),
+        m_capacity(CODE_BUFFER_SIZE),
+        m_size(0),
+        m_start(0),
+        m_overflow(false),
+        m_available(false)
+    {
+        void* p = mmap(nullptr, m_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            fmt::print("Couldn't map the dynarec code buffer, only the interpreter will run\n");
+            return;
+        }
+
+        m_code = static_cast<u8*>(p);
+        m_available = true;
+    }
+
+    Dynarec::~Dynarec()
+    {
+        if (m_code != nullptr)
+        {
+            munmap(m_code, m_capacity);
+        }
+    }
+
+    bool Dynarec::available()
+    {
+        return m_available;
+    }
+
+    void Dynarec::begin()
+    {
+        m_start = m_size;
+        m_overflow = !m_available || !m_protect(m_capacity, PROT_READ | PROT_WRITE);
+    }
+
+    void* Dynarec::end()
+    {
+        if (!m_available)
+        {
+            return nullptr;
+        }
+
+        const bool overflow = m_overflow;
+        if (overflow)
+        {
+            m_size = m_start;
+        }
+
+        if (!m_protect(m_size, PROT_READ | PROT_EXEC) || overflow)
+        {
+            return nullptr;
+        }
+
+        return m_code + m_start;
+    }
+
+    void Dynarec::clear()
+    {
+        m_size = 0;
+        m_start = 0;
+        m_overflow = false;
+    }
+
+    void Dynarec::emit(std::initializer_list<u8> bytes)
+    {
+        if (m_size + bytes.size() > m_capacity)
+        {
+            m_overflow = true;
+            return;
+        }
+
+        for (auto b : bytes)
+        {
+            m_code[m_size++] = b;
+        }
+    }
+
+    void Dynarec::emit_32(u32 v)
+    {
+        emit({ (u8)v, (u8)(v >> 8), (u8)(v >> 16), (u8)(v >> 24) });
+    }
+
+    void Dynarec::emit_64(u64 v)
+    {
+        emit_32((u32)v);
+        emit_32((u32)(v >> 32));
+    }
+
+    // The translations before the current one stay executable, the space after it stays writable
+    bool Dynarec::m_protect(std::size_t end, int prot)
+    {
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        const std::size_t first = m_start - m_start % page;
+        const std::size_t last = std::min(m_capacity, (end + page - 1) / page * page);
+
+        if (mprotect(m_code + first, last - first, prot) != 0)
+        {
+            fmt::print("Couldn't protect the dynarec code buffer, only the interpreter will run\n");
+            m_available = false;
+            return false;
+        }
+
+        return true;
+    }
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include "integers.h"
+#include <cstddef>
+#include <initializer_list>
+
+#if defined(PGBE_DYNAREC) && !(defined(__x86_64__) && !defined(_WIN32))
+#error "The dynarec only targets x86-64 hosts using the System V calling convention"
+#endif
+
+namespace PGBE
+{
+    // Executable memory holding the x86-64 translations of SM83 blocks, see SM83::m_translate.
+    // The buffer is never writable and executable at once : it is made writable by begin() and
+    // executable again by end()
+    class Dynarec
+    {
+    public:
+        Dynarec();
+        ~Dynarec();
+
+        Dynarec(const Dynarec&) = delete;
+        Dynarec& operator=(const Dynarec&) = delete;
+
+        // False when the buffer couldn't be mapped or protected, nothing can be translated then
+        bool available();
+
+        // Starts a new translation at the end of the buffer
+        void begin();
+        // Returns the entry point of the translation, nullptr if the buffer ran out of space
+        void* end();
+        // Drops every translation
+        void clear();
+
+        void emit(std::initializer_list<u8> bytes);
+        void emit_32(u32 v);
+        void emit_64(u64 v);
+    private:
+        u8* m_code;
+        std::size_t m_capacity;
+        std::size_t m_size;
+        std::size_t m_start;
+        bool m_overflow;
+        bool m_available;
+
+        // Protects the pages from the start of the current translation up to that offset
+        bool m_protect(std::size_t end, int prot);
+    };
+}
\ No newline at end of file
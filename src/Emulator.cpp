@@ -0,0 +1,138 @@
+#include "Emulator.h"
+#include "GameBoy.h"
+#include <array>
+#include <string>
+#include <vector>
+
+namespace PGBE
+{
+    static_assert(sizeof(color) == 3, "The framebuffer is handed out as RGB24");
+    // set_button() hands the button over as is
+    static_assert((int)Emulator::RIGHT == (int)GB_RIGHT && (int)Emulator::LEFT == (int)GB_LEFT
+        && (int)Emulator::UP == (int)GB_UP && (int)Emulator::DOWN == (int)GB_DOWN
+        && (int)Emulator::A == (int)GB_A && (int)Emulator::B == (int)GB_B
+        && (int)Emulator::SELECT == (int)GB_SELECT && (int)Emulator::START == (int)GB_START);
+
+    struct Emulator::machine
+    {
+        GameBoy gb;
+        std::array<color, FRAMEBUFFER_SIZE> framebuffer;
+        std::string serial;
+        std::vector<u8> boot_rom;
+    };
+
+    Emulator::Emulator() :
+        m_machine(std::make_unique<machine>())
+    {
+        m_machine->framebuffer.fill(color{.r = 0, .g = 0, .b = 0});
+        m_machine->gb.ppu.framebuffer = &m_machine->framebuffer;
+        m_machine->gb.mmu.serial_log = &m_machine->serial;
+        // Runs are reproducible whatever the host speed
+        m_machine->gb.mmu.rtc_mode = RTC_EMULATED_CLOCK;
+    }
+
+    Emulator::~Emulator()
+    {
+    }
+
+    bool Emulator::load_rom(std::span<const u8> rom)
+    {
+        auto image = RomImage::copy(rom);
+        if (image == nullptr)
+        {
+            return false;
+        }
+
+        m_machine->gb.reset();
+        m_machine->gb.mmu.load_game_rom(std::move(image));
+        m_power_on();
+
+        return true;
+    }
+
+    bool Emulator::load_rom_file(std::string_view path, bool persist_battery)
+    {
+        // Opened first so that a bad file leaves the current cartridge running,
+        // the MMU then gets the same image from the cache
+        auto image = RomImage::open(path);
+        if (image == nullptr)
+        {
+            return false;
+        }
+
+        m_machine->gb.reset();
+        m_machine->gb.mmu.load_game_rom(path, persist_battery);
+        m_power_on();
+
+        return true;
+    }
+
+    void Emulator::set_boot_rom(std::span<const u8> boot_rom)
+    {
+        m_machine->boot_rom.assign(boot_rom.begin(), boot_rom.end());
+    }
+
+    void Emulator::set_button(button b, bool pressed)
+    {
+        m_machine->gb.use_button((GB_BUTTON)b, pressed);
+    }
+
+    bool Emulator::run_frame(bool render)
+    {
+        return m_machine->gb.run_frame(render);
+    }
+
+    int Emulator::run_cycles(u64 m_cycles, bool render)
+    {
+        return m_machine->gb.run_cycles(m_cycles, render);
+    }
+
+    std::span<const u8> Emulator::framebuffer() const
+    {
+        return { reinterpret_cast<const u8*>(m_machine->framebuffer.data()), m_machine->framebuffer.size() * sizeof(color) };
+    }
+
+    u64 Emulator::cycles() const
+    {
+        return m_machine->gb.cpu.cycles();
+    }
+
+    u64 Emulator::instructions() const
+    {
+        return m_machine->gb.cpu.instructions();
+    }
+
+    std::string_view Emulator::serial_output() const
+    {
+        return m_machine->serial;
+    }
+
+    std::size_t Emulator::state_size() const
+    {
+        return m_machine->gb.state_size();
+    }
+
+    bool Emulator::save_state(std::span<u8> out) const
+    {
+        return m_machine->gb.save_state(out);
+    }
+
+    bool Emulator::load_state(std::span<const u8> state)
+    {
+        return m_machine->gb.load_state(state);
+    }
+
+    void Emulator::m_power_on()
+    {
+        m_machine->serial.clear();
+
+        if (m_machine->boot_rom.empty())
+        {
+            m_machine->gb.skip_boot_rom();
+        }
+        else
+        {
+            m_machine->gb.mmu.load_boot_rom(m_machine->boot_rom);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+#include "integers.h"
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace PGBE
+{
+    // libpgbe entry point : one Game Boy without any frontend. Embedders only need this header,
+    // the machine internals can change without breaking them.
+    class Emulator
+    {
+    public:
+        static constexpr int SCREEN_WIDTH = 160;
+        static constexpr int SCREEN_HEIGHT = 144;
+
+        // Joypad register bit order
+        enum button
+        {
+            RIGHT = 0,
+            LEFT = 1,
+            UP = 2,
+            DOWN = 3,
+            A = 4,
+            B = 5,
+            SELECT = 6,
+            START = 7,
+        };
+
+        Emulator();
+        ~Emulator();
+
+        Emulator(const Emulator&) = delete;
+        Emulator& operator=(const Emulator&) = delete;
+
+        // Power cycles the machine with that cartridge, false when it isn't a rom.
+        // The rom is copied and its battery-backed RAM isn't persisted.
+        bool load_rom(std::span<const u8> rom);
+        // Same from a file, shared with the other instances running it. With persist_battery
+        // the battery-backed RAM is kept in a .sav file next to it.
+        bool load_rom_file(std::string_view path, bool persist_battery = false);
+        // Run by the next loaded roms, without one they start in the post boot state
+        void set_boot_rom(std::span<const u8> boot_rom);
+
+        void set_button(button b, bool pressed);
+
+        // Runs up to the end of the next frame, or a frame worth of cycles while the LCD is off.
+        // Returns whether a frame completed. Without render nothing is drawn, for frames
+        // never shown, everything else runs the same.
+        bool run_frame(bool render = true);
+        // Runs that many M-cycles across frame ends, returns the number of frames completed
+        int run_cycles(u64 m_cycles, bool render = true);
+
+        // SCREEN_WIDTH * SCREEN_HEIGHT RGB24 pixels, the last frame after run_frame()
+        std::span<const u8> framebuffer() const;
+        // M-cycles run by this instance
+        u64 cycles() const;
+        // Instructions run by this instance
+        u64 instructions() const;
+        // Bytes the rom sent through the serial port
+        std::string_view serial_output() const;
+
+        // Snapshot of the whole machine, framebuffer included. Its size only changes with the cartridge
+        // and save_state() never allocates, it fails when out is smaller than state_size().
+        std::size_t state_size() const;
+        bool save_state(std::span<u8> out) const;
+        // Fails, leaving the machine as it was, on a state from another version or cartridge
+        bool load_state(std::span<const u8> state);
+    private:
+        struct machine;
+
+        void m_power_on();
+
+        std::unique_ptr<machine> m_machine;
+    };
+}
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "GameBoy.h"
 #include "utils.h"
+#include <cstring>
+#include <fmt/core.h>
+#include <vector>
 
 namespace PGBE
 {
@@ -7,7 +10,7 @@ namespace PGBE
         mmu(),
         ppu(&mmu),
         timer(&mmu, &ppu),
-        cpu(&mmu, &timer),
+        cpu(&mmu, &timer, &ppu),
         show_perf(true),
         show_memory(false),
         show_vram(false),
@@ -30,13 +33,163 @@ namespace PGBE
 
     void GameBoy::use_button(const GB_BUTTON b, const bool pressed)
     {
-        if (pressed)
+        // Only a line going low requests the interrupt, holding a key down doesn't
+        if (pressed && !mmu.p_input.at(b))
         {
-            u8 &r_IF = mmu.io_reg->at(IF);
+            u8 &r_IF = mmu.io_reg.at(IF);
 
             set_bit(r_IF, 4);
         }
         
         mmu.p_input.at(b) = pressed;
     }
+
+    void GameBoy::skip_boot_rom()
+    {
+        cpu.skip_boot();
+
+        mmu.write(0xFF00 + LCDC, 0x91);
+        mmu.write(0xFF00 + BGP, 0xFC);
+        mmu.write(0xFF00 + BANK, 1);
+    }
+
+    bool GameBoy::run_frame(bool render)
+    {
+        ppu.render = render;
+
+        if (ppu.frame_completed())
+        {
+            ppu.reset();
+        }
+
+        const u64 end = cpu.cycles() + FRAME_DURATION / 4;
+        while (!ppu.frame_completed() && cpu.cycles() < end)
+        {
+            cpu.run_for(end - cpu.cycles());
+        }
+
+        return ppu.frame_completed();
+    }
+
+    int GameBoy::run_cycles(u64 m_cycles, bool render)
+    {
+        ppu.render = render;
+
+        int frames = 0;
+        const u64 end = cpu.cycles() + m_cycles;
+        while (cpu.cycles() < end)
+        {
+            if (ppu.frame_completed())
+            {
+                ppu.reset();
+            }
+
+            cpu.run_for(end - cpu.cycles());
+
+            if (ppu.frame_completed())
+            {
+                ++frames;
+            }
+        }
+
+        return frames;
+    }
+
+    std::size_t GameBoy::state_size()
+    {
+        StateWriter counter;
+        cpu.save_state(counter);
+        mmu.save_state(counter);
+        ppu.save_state(counter, false);
+        timer.save_state(counter);
+
+        return sizeof(save_state_header) + counter.size();
+    }
+
+    bool GameBoy::save_state(std::span<u8> out, bool with_framebuffer)
+    {
+        const std::size_t size = state_size();
+        if (out.size() < size)
+        {
+            return false;
+        }
+
+        StateWriter w(out.first(size));
+        w.put(save_state_header
+        {
+            .magic = SAVE_STATE_MAGIC,
+            .version = SAVE_STATE_VERSION,
+            .size = size,
+            .cartridge = mmu.cartridge_id(),
+            .flags = with_framebuffer ? 0 : SAVE_STATE_NO_FRAMEBUFFER
+        });
+        cpu.save_state(w);
+        mmu.save_state(w);
+        ppu.save_state(w, with_framebuffer);
+        timer.save_state(w);
+
+        return true;
+    }
+
+    bool GameBoy::load_state(std::span<const u8> state)
+    {
+        save_state_header header{};
+        if (state.size() >= sizeof(header))
+        {
+            std::memcpy(&header, state.data(), sizeof(header));
+        }
+
+        if (header.magic != SAVE_STATE_MAGIC || header.version != SAVE_STATE_VERSION)
+        {
+            fmt::print("Not a save state of this version...\n");
+            return false;
+        }
+
+        if (header.cartridge != mmu.cartridge_id() || header.size != state.size() || state.size() != state_size())
+        {
+            fmt::print("Save state of another cartridge...\n");
+            return false;
+        }
+
+        // Values out of range only show up while loading
+        m_rollback.resize(state.size());
+        save_state(m_rollback);
+
+        if (!m_load_components(state))
+        {
+            m_load_components(m_rollback);
+            fmt::print("Corrupted save state...\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool GameBoy::m_load_components(std::span<const u8> state)
+    {
+        save_state_header header{};
+        std::memcpy(&header, state.data(), sizeof(header));
+
+        StateReader r(state.subspan(sizeof(header)));
+        cpu.load_state(r);
+        const bool valid = mmu.load_state(r);
+        ppu.load_state(r, (header.flags & SAVE_STATE_NO_FRAMEBUFFER) == 0);
+        timer.load_state(r);
+
+        return valid;
+    }
+
+    u64 GameBoy::state_hash()
+    {
+        std::vector<u8> state(state_size());
+        save_state(state, false);
+
+        u64 hash = 0xCBF29CE484222325;
+        for (u8 b : state)
+        {
+            hash = (hash ^ b) * 0x100000001B3;
+        }
+
+        return hash;
+    }
 }
\ No newline at end of file
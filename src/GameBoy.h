@@ -4,8 +4,10 @@
 #include "PPU.h"
 #include "SM83.h"
 #include "Timer.h"
-#include <SDL.h>
+#include <cstddef>
+#include <span>
 #include <string_view>
+#include <vector>
 
 namespace PGBE
 {
@@ -23,12 +25,6 @@ namespace PGBE
     };
     constexpr auto BUTTON_ENUM_SIZE = __LINE__ - BUTTON_START_LINE - 4;
 
-    struct GB_MAP
-    {
-        GB_BUTTON b;
-        SDL_Keycode k;
-    };
-
     struct GameBoy
     {
         MMU mmu;
@@ -46,5 +42,26 @@ namespace PGBE
 
         void reset();
         void use_button(const GB_BUTTON b, const bool pressed);
+        // Starts the cartridge at 0x0100 in the state the DMG boot rom leaves
+        void skip_boot_rom();
+        // Runs up to the end of the next frame, or a frame worth of cycles while the LCD is off.
+        // The framebuffer holds the frame until the next call, without render it isn't drawn.
+        bool run_frame(bool render = true);
+        // Runs that many M-cycles across frame ends, returns the number of frames completed
+        int run_cycles(u64 m_cycles, bool render = true);
+
+        // Bytes save_state() writes, only depends on the cartridge
+        std::size_t state_size();
+        // Snapshot of the whole machine into out, false when it is too small. Never allocates.
+        // Without the framebuffer the state is as large, loading it leaves the framebuffer as it is.
+        bool save_state(std::span<u8> out, bool with_framebuffer = true);
+        // False, leaving the machine untouched, when the state is from another version or cartridge or corrupted
+        bool load_state(std::span<const u8> state);
+        // FNV-1a of the whole state but the framebuffer, drawn from the rest : equal machines hash the same
+        u64 state_hash();
+    private:
+        std::vector<u8> m_rollback; // machine before the last load, put back when the state is rejected
+
+        bool m_load_components(std::span<const u8> state);
     };
 }
\ No newline at end of file
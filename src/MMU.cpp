@@ -1,90 +1,148 @@
 #include "MMU.h"
 #include "Timer.h"
 #include "utils.h"
+#include <algorithm>
 #include <cstring>
+#include <filesystem>
 #include <fmt/core.h>
 #include <fstream>
 
 namespace PGBE
 {
     MMU::MMU() :
-        m_boot_rom(std::make_unique<std::array<u8, 256>>()),
-        m_ext_ram(0x2000),
-        vram(std::make_unique<std::array<u8, 0x2000>>()),
-        wram(std::make_unique<std::array<u8, 0x2000>>()),
-        oam(std::make_unique<std::array<u8, 0x00A0>>()),
-        io_reg(std::make_unique<std::array<u8, 0x0080>>()),
-        hram(std::make_unique<std::array<u8, 0x007F>>()),
+        m_boot_rom(),
+        m_ext_ram(),
+        vram(),
+        wram(),
+        oam(),
+        io_reg(),
+        hram(),
         ie_reg(0xE0),
         internal_div(0),
         m_dma_bus_conflict(false),
-        m_STAT((STAT_REG&)io_reg->at(STAT)),
+        m_STAT((STAT_REG&)io_reg.at(STAT)),
         m_select_action(false),
         m_select_direction(false),
-        m_rom_gb(),
-        m_has_ram(false),
-        m_has_battery_buffered_ram(false),
-        m_has_real_time_clock(false),
-        m_has_rumble(false),
-        m_has_accelerometer(false),
-        m_ext_ram_enabled(false),
-        m_mbc_type(None),
-        m_mode_flag(false),
-        m_ram_size(0),
-        m_rom_size(0),
-        m_ram_bank_nb(0),
-        m_rom_bank_nb(1),
-        boot_rom_enabled(true)
+        boot_rom_enabled(true),
+        rtc_mode(RTC_HOST_CLOCK),
+        m_rom(),
+        m_save(),
+        m_mapper(std::make_unique<NoMBC>(std::span<const u8>{}, std::span<u8>{}))
     {
-        m_boot_rom->fill(0x00);
-        vram->fill(0);
-        wram->fill(0);
-        oam->fill(0);
-        io_reg->fill(0);
-        hram->fill(0);
-
-        io_reg->at(P1_JOYP) = 0xFF;
+        m_boot_rom.fill(0x00);
+        vram.fill(0);
+        wram.fill(0);
+        oam.fill(0);
+        io_reg.fill(0);
+        hram.fill(0);
+
+        io_reg.at(P1_JOYP) = 0xFF;
         timer = nullptr;
+        serial_log = nullptr;
 
         p_input.fill(false);
+        m_map_pages(0x00, 0xFF);
     }
 
     void MMU::reset()
     {
         // To complete
-        std::fill(m_ext_ram.begin(), m_ext_ram.end(), 0);
-        vram->fill(0);
-        wram->fill(0);
-        oam->fill(0);
-        io_reg->fill(0);
-        hram->fill(0);
+        vram.fill(0);
+        wram.fill(0);
+        oam.fill(0);
+        io_reg.fill(0);
+        hram.fill(0);
         ie_reg = 0xE0;
         internal_div = 0;
         m_dma_bus_conflict = false;
         m_select_action = false;
         m_select_direction = false;
 
-        m_has_ram = false;
-        m_has_battery_buffered_ram = false;
-        m_has_real_time_clock = false;
-        m_has_rumble = false;
-        m_has_accelerometer = false;
-        m_ext_ram_enabled = false;
-        m_mbc_type = None;
-        m_mode_flag = false;
-        m_ram_size = 0;
-        m_rom_size = 0;
-        m_ram_bank_nb = 0;
-        m_rom_bank_nb = 1;
-
-        io_reg->at(P1_JOYP) = 0xFF;
+        io_reg.at(P1_JOYP) = 0xFF;
         p_input.fill(false);
 
-        m_rom_gb.clear();
+        m_mapper = std::make_unique<NoMBC>(std::span<const u8>{}, std::span<u8>{});
+        m_ext_ram.clear();
+        m_save.reset();
+        m_rom.reset();
         boot_rom_enabled = true;
+        m_map_pages(0x00, 0xFF);
+    }
+
+    void MMU::map_vram()
+    {
+        // Only the write side depends on the mode
+        const bool writable = (m_STAT.ppu_mode <= 2);
+        for (int page = 0x80; page <= 0x9F; ++page)
+        {
+            m_write_pages[page] = writable ? m_read_pages[page] : nullptr;
+        }
+    }
+
+    void MMU::m_map_pages(int first, int last)
+    {
+        for (int page = first; page <= last; ++page)
+        {
+            const u16 adr = (u16)(page << 8);
+            u8* host = nullptr;
+            bool writable = false;
+
+            if (adr >= 0xFE00)
+            {
+                // OAM shares its page with the unusable area, I/O have side effects
+            }
+            else if (adr <= 0x7FFF)
+            {
+                // Writes are MBC commands
+                host = get_host_adr(adr);
+            }
+            else if (adr <= 0x9FFF)
+            {
+                host = get_host_adr(adr);
+                writable = (m_STAT.ppu_mode <= 2);
+            }
+            else if (adr <= 0xBFFF)
+            {
+                // nullptr when disabled, or not plain memory like on MBC2.
+                // Persisted RAM is written through the slow path to be marked dirty.
+                host = get_host_adr(adr);
+                writable = (m_save == nullptr);
+            }
+            else
+            {
+                host = get_host_adr(adr);
+                writable = true;
+            }
+
+            m_read_pages[page] = host;
+            m_write_pages[page] = writable ? host : nullptr;
+        }
     }
 
     u8 MMU::read(u16 adr)
+    {
+        const u8* page = m_read_pages[adr >> 8];
+        if (page != nullptr)
+        {
+            return page[adr & 0xFF];
+        }
+
+        return m_read_slow(adr);
+    }
+
+    void MMU::write(u16 adr, u8 v)
+    {
+        u8* page = m_write_pages[adr >> 8];
+        if (page != nullptr)
+        {
+            page[adr & 0xFF] = v;
+            return;
+        }
+
+        m_write_slow(adr, v);
+    }
+
+    u8 MMU::m_read_slow(u16 adr)
     {
         if (adr == 0xFF00) // JOYPAD
         {
@@ -117,17 +175,23 @@ namespace PGBE
             return res;
         }
 
-        auto p = get_host_adr(adr);
+        // DIV and TIMA are only counted up to now when read
+        if (adr == 0xFF00 + DIV || adr == 0xFF00 + TIMA)
+        {
+            timer->sync();
+        }
 
-        if (m_mbc_type == MBC2)
+        if (0xA000 <= adr && adr <= 0xBFFF)
         {
-            return (0xF0 | (*p & 0xF));
+            return m_mapper->read_ram(adr);
         }
 
+        auto p = get_host_adr(adr);
+
         return (p == nullptr) ? 0xFF : *p;
     }
 
-    void MMU::write(u16 adr, u8 v)
+    void MMU::m_write_slow(u16 adr, u8 v)
     {
         if (adr == 0xFF00) // JOYPAD 
         { 
@@ -137,115 +201,48 @@ namespace PGBE
             return;
         }
 
-        switch (m_mbc_type)
+        if (adr <= 0x7FFF)
         {
-        case MBC1:
-            if (0x0000 <= adr && adr <= 0x1FFF) // Enable RAM
+            // Latching updates the saved clock state
+            if (adr >= 0x6000 && m_mapper->has_rtc && m_save != nullptr)
             {
-                m_ext_ram_enabled = ((v & 0x0F) == 0x0A);
+                m_save->write([&] { m_mapper->write(adr, v); });
             }
-            else if (0x2000 <= adr && adr <= 0x3FFF) // ROM Bank
+            else
             {
-                if (v == 0)
-                {
-                    m_rom_bank_nb = 1;
-                    return;
-                }
+                m_mapper->write(adr, v);
+            }
 
-                u8 mask = 0;
-                switch (m_rom_size)
-                {
-                case 128:
-                case 64:
-                case 32:
-                    mask = 0b0001'1111;
-                    break;
-                case 16:
-                    mask = 0b0000'1111;
-                    break;
-                case 8:
-                    mask = 0b0000'0111;
-                    break;
-                case 4:
-                    mask = 0b0000'0011;
-                    break;
-                case 2:
-                    mask = 0b0000'0001;
-                    break;
-                }
+            // Bank switch
+            m_map_pages(0x00, 0x7F);
+            m_map_pages(0xA0, 0xBF);
+            return;
+        }
 
-                m_rom_bank_nb = v & mask;                
-            }
-            else if (0x4000 <= adr && adr <= 0x5FFF) // RAM Bank
-            {
-                m_ram_bank_nb = v & 0b11;
-            }
-            else if (0x6000 <= adr && adr <= 0x7FFF) // Mode Select
-            {
-                m_mode_flag = ((v & 0b1) == 1);
-            }
-            break;
-        case MBC2:
-            if (0x0000 <= adr && adr <= 0x3FFF)
+        if (0xA000 <= adr && adr <= 0xBFFF)
+        {
+            auto write_ram = [&]
             {
-                bool ch_ram = ((adr & 0x100) == 0);
-                if (ch_ram)
+                auto p = get_host_adr(adr);
+                if (p != nullptr)
                 {
-                    if ((v & 0xF) == 0xA)
-                    {
-                        m_ext_ram_enabled = true;
-                    }
-                    else
-                    {
-                        m_ext_ram_enabled = false;
-                    }
+                    *p = v;
                 }
                 else
                 {
-                    m_rom_bank_nb = (v == 0) ? 1 : v;
+                    m_mapper->write_ram(adr, v);
                 }
-            }
-        break;
-        case MBC3:
-        // TO DO : impl rtc stuff
-            if (0x0000 <= adr && adr <= 0x1FFF)
-            {
-                m_ext_ram_enabled = ((v & 0x0F) == 0x0A);
-            }
-            else if (0x2000 <= adr && adr <= 0x3FFF)
-            {
-                m_rom_bank_nb = (v == 0) ? 1 : (v & 0xF);
-            }
-            else if (0x4000 <= adr && adr <= 0x5FFF)
-            {
-                if (0x00 <= v && v <= 0x03)
-                {
-                    m_ram_bank_nb = v;
-                }
-            }
-        break;
-        case MBC5:
-            if (0x0000 <= adr && adr <= 0x1FFF)
-            {
-                m_ext_ram_enabled = ((v & 0x0F) == 0x0A);
-            }
-            else if (0x2000 <= adr && adr <= 0x2FFF)
-            {
-                m_rom_bank_nb &= 0xFF00;
-                m_rom_bank_nb |= v;
-            }
-            else if (0x3000 <= adr && adr <= 0x3FFF)
+            };
+
+            if (m_save != nullptr)
             {
-                m_rom_bank_nb &= 0x00FF;
-                m_rom_bank_nb |= ((v & 0x01) << 8);
+                m_save->write(write_ram);
             }
-            else if (0x4000 <= adr && adr <= 0x5FFF)
+            else
             {
-                m_ram_bank_nb = v;
+                write_ram();
             }
-        break;
-        default:
-            break;
+            return;
         }
 
         if (is_locked(adr))
@@ -253,14 +250,14 @@ namespace PGBE
             return;
         }
 
+        if (0xFF00 + DIV <= adr && adr <= 0xFF00 + TAC)
+        {
+            timer->sync();
+        }
+
         auto p = get_host_adr(adr);
         if (p != nullptr)
         {
-            if (m_mbc_type == MBC2)
-            {
-                *p = (v & 0xF);
-            }
-
             *p = v;
         }
 
@@ -270,22 +267,47 @@ namespace PGBE
             {
             case DIV:
                 internal_div = 0;
+                timer->reschedule();
+                break;
+            case TIMA:
+            case TMA:
+            case TAC:
+                timer->reschedule();
                 break;
             case SB:
-            // DEBUG
-                fmt::print("{:c}", v);
+                if (serial_log != nullptr)
+                {
+                    serial_log->push_back((char)v);
+                }
+                else
+                {
+                    // DEBUG
+                    fmt::print("{:c}", v);
+                }
                 break;
             case DMA:
-                timer->schedule_task(4, std::bind(&MMU::oam_dma_transfer, this, v));
+                // Copied on the 5th T-cycle after the write
+                scheduler.schedule(scheduler.now + 5, PHASE_TIMER, EVENT_OAM_DMA, v);
                 break;
             case BANK:
                 if (v == 1)
                 {
                     boot_rom_enabled = false;
+                    m_map_pages(0x00, 0x00);
                 }
                 break;
             case LYC:
-                m_STAT.coincidence_flag = (io_reg->at(LY) == io_reg->at(LYC));
+                m_STAT.coincidence_flag = (io_reg.at(LY) == io_reg.at(LYC));
+                scheduler.schedule(scheduler.now + 1, PHASE_STAT, EVENT_PPU_STAT);
+                break;
+            case LCDC:
+                // Seen by the PPU on the next T-cycle
+                scheduler.schedule(scheduler.now + 1, PHASE_STAT, EVENT_PPU_STAT);
+                break;
+            case STAT:
+                // The mode bits were overwritten too
+                map_vram();
+                scheduler.schedule(scheduler.now + 1, PHASE_STAT, EVENT_PPU_STAT);
                 break;
             }
         }
@@ -297,105 +319,39 @@ namespace PGBE
         {
             if (gb_adr < 0x0100 && boot_rom_enabled)
             {
-                return m_boot_rom->data() + gb_adr;
-            }
-
-            if (m_rom_gb.empty())
-            {
-                return nullptr;
+                return m_boot_rom.data() + gb_adr;
             }
 
-            if (m_mode_flag)
-            {
-                int zero_bank_nb = 0;
-
-                if (m_rom_size == 64)
-                {
-                    // not workign for MBC1M 
-                    zero_bank_nb = (m_ram_bank_nb & 0b1) << 5;
-                }
-
-                if (m_rom_size == 128)
-                {
-                    zero_bank_nb = (m_ram_bank_nb & 0b11) << 5;
-                }
-
-                return m_rom_gb.data() + (zero_bank_nb * 0x4000) + gb_adr;
-            }
-            else
-            {
-                return m_rom_gb.data() + gb_adr;
-            }
-            
+            // The rom is mapped read-only, writes to it are MBC commands and never get there
+            return (m_mapper->rom_lo == nullptr) ? nullptr : const_cast<u8*>(m_mapper->rom_lo) + gb_adr;
         }
         else if (0x4000 <= gb_adr && gb_adr <= 0x7FFF)
         {
-            if (m_rom_gb.empty())
-            {
-                return nullptr;
-            }
-
-            if (m_rom_size == 64)
-            {
-                m_rom_bank_nb &= ~(0b1 << 5);
-                m_rom_bank_nb |= ((m_ram_bank_nb & 0b1) << 5);
-            }
-
-            if (m_rom_size == 128)
-            {
-                m_rom_bank_nb &= ~(0b11 << 5);
-                m_rom_bank_nb |= ((m_ram_bank_nb & 0b11) << 5);
-            }
-
-            return m_rom_gb.data() + (m_rom_bank_nb * 0x4000) + (gb_adr - 0x4000);
+            return (m_mapper->rom_hi == nullptr) ? nullptr : const_cast<u8*>(m_mapper->rom_hi) + (gb_adr - 0x4000);
         }
         else if (0x8000 <= gb_adr && gb_adr <= 0x9FFF)
         {
-            return vram->data() + gb_adr - 0x8000;
+            return vram.data() + gb_adr - 0x8000;
         }
         else if (0xA000 <= gb_adr && gb_adr <= 0xBFFF)
         {
-            if (m_ext_ram_enabled)
-            {
-                if (m_mbc_type == MBC2)
-                {
-                    gb_adr &= 0x1FF;
-
-                    return m_ext_ram.data() + gb_adr;
-                }
-
-                gb_adr -= 0xA000;
-                if (m_ram_size <= 8192)
-                {
-                    gb_adr %= m_ram_size;
-                }
-                else if (m_mode_flag)
-                {
-                    gb_adr += 0x2000 * m_ram_bank_nb;
-                }
-
-                return m_ext_ram.data() + gb_adr;
-            }
-            else
-            {
-                return nullptr;
-            }
+            return (m_mapper->ram == nullptr) ? nullptr : m_mapper->ram + ((gb_adr - 0xA000) & m_mapper->ram_mask);
         }
         else if (0xC000 <= gb_adr && gb_adr <= 0xFDFF)
         {
-            return wram->data() + (gb_adr & 0x1FFF);
+            return wram.data() + (gb_adr & 0x1FFF);
         }
         else if (0xFE00 <= gb_adr && gb_adr <= 0xFE9F)
         {
-            return oam->data() + gb_adr - 0xFE00;
+            return oam.data() + gb_adr - 0xFE00;
         }
         else if (0xFF00 <= gb_adr && gb_adr <= 0xFF7F)
         {
-            return io_reg->data() + gb_adr - 0xFF00;
+            return io_reg.data() + gb_adr - 0xFF00;
         }
         else if (0xFF80 <= gb_adr && gb_adr <= 0xFFFE)
         {
-            return hram->data() + gb_adr - 0xFF80;
+            return hram.data() + gb_adr - 0xFF80;
         }
         else if (gb_adr == 0xFFFF)
         {
@@ -405,6 +361,41 @@ namespace PGBE
         return nullptr;
     }
 
+    int MMU::code_bank(u16 gb_adr)
+    {
+        if (gb_adr <= 0x7FFF)
+        {
+            if (gb_adr < 0x0100 && boot_rom_enabled)
+            {
+                return CODE_BANK_BOOT_ROM;
+            }
+
+            if (m_rom == nullptr)
+            {
+                return -1;
+            }
+
+            const auto rom = m_rom->data();
+            auto offset = get_host_adr(gb_adr) - rom.data();
+            if (offset < 0 || offset >= (std::ptrdiff_t)rom.size())
+            {
+                return -1;
+            }
+
+            return (int)(offset / 0x4000);
+        }
+        else if (0xC000 <= gb_adr && gb_adr <= 0xDFFF)
+        {
+            return CODE_BANK_WRAM;
+        }
+        else if (0xFF80 <= gb_adr && gb_adr <= 0xFFFE)
+        {
+            return CODE_BANK_HRAM;
+        }
+
+        return -1;
+    }
+
     void  MMU::load_boot_rom(std::string_view path)
     {
         std::ifstream input(std::string{path}, std::ios::binary);
@@ -415,196 +406,145 @@ namespace PGBE
             exit(1);
         }
 
-        input.read(reinterpret_cast<char*>(m_boot_rom.get()), m_boot_rom->size());
+        input.read(reinterpret_cast<char*>(m_boot_rom.data()), m_boot_rom.size());
     }
 
-    void MMU::load_game_rom(std::string_view path)
+    void MMU::load_boot_rom(std::span<const u8> boot_rom)
     {
-        std::ifstream input(std::string{path}, std::ios::binary);
-        m_rom_gb = std::vector<u8>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
-
-        u8 mbc_type = m_rom_gb.at(0x147);
-        switch (mbc_type)
-        {
-        case 0x00:
-            m_mbc_type = None;
-            break;
-        case 0x01:
-            m_mbc_type = MBC1;
-            break;
-        case 0x02:
-            m_mbc_type = MBC1;
-            m_has_ram = true;
-            break;
-        case 0x03:
-            m_mbc_type = MBC1;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x05:
-            m_mbc_type = MBC2;
-            break;
-        case 0x06:
-            m_mbc_type = MBC2;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x08:
-            m_mbc_type = None;
-            m_has_ram = true;
-            break;
-        case 0x09:
-            m_mbc_type = None;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x0B:
-            m_mbc_type = MMM01;
-            break;
-        case 0x0C:
-            m_mbc_type = MMM01;
-            m_has_ram = true;
-            break;
-        case 0x0D:
-            m_mbc_type = MMM01;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x0F:
-            m_mbc_type = MBC3;
-            m_has_real_time_clock = true;
-            break;
-        case 0x10:
-            m_mbc_type = MBC3;
-            m_has_real_time_clock = true;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x11:
-            m_mbc_type = MBC3;
-            break;
-        case 0x12:
-            m_mbc_type = MBC3;
-            m_has_ram = true;
-            break;
-        case 0x13:
-            m_mbc_type = MBC3;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x19:
-            m_mbc_type = MBC5;
-            break;
-        case 0x1A:
-            m_mbc_type = MBC5;
-            m_has_ram = true;
-            break;
-        case 0x1B:
-            m_mbc_type = MBC5;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x1C:
-            m_mbc_type = MBC5;
-            m_has_rumble = true;
-            break;
-        case 0x1D:
-            m_mbc_type = MBC5;
-            m_has_rumble = true;
-            m_has_ram = true;
-            break;
-        case 0x1E:
-            m_mbc_type = MBC5;
-            m_has_rumble = true;
-            m_has_battery_buffered_ram = true;
-            break;
-        case 0x20:
-            m_mbc_type = MBC6;
-            break;
-        case 0x22:
-            m_mbc_type = MBC7;
-            m_has_rumble = true;
-            m_has_battery_buffered_ram = true;
-            m_has_accelerometer = true;
-            break;
-        case 0xFC:
-            m_mbc_type = POCKET_CAMERA;
-            break;
-        case 0xFD:
-            m_mbc_type = BANDAI_TAMA5;
-            break;
-        case 0xFE:
-            m_mbc_type = HUC3;
-            break;
-        case 0xFF:
-            m_mbc_type = HUC1;
-            break;
-        }
-
-        u8 rom_size = m_rom_gb.at(0x148);
-        switch (rom_size)
-        {
-        case 0x00:
-            m_rom_size = 0;
-            break;
-        case 0x01:
-            m_rom_size = 4;
-            break;
-        case 0x02:
-            m_rom_size = 8;
-            break;
-        case 0x03:
-            m_rom_size = 16;
-            break;
-        case 0x04:
-            m_rom_size = 32;
-            break;
-        case 0x05:
-            m_rom_size = 64;
-            break;
-        case 0x06:
-            m_rom_size = 128;
-            break;
-        case 0x07:
-            m_rom_size = 256;
-            break;
-        case 0x08:
-            m_rom_size = 512;
-            break;
-        case 0x52:
-            m_rom_size = 72;
-            break;
-        case 0x53:
-            m_rom_size = 80;
-            break;
-        case 0x54:
-            m_rom_size = 96;
-            break;
-        }
-
-        u8 ram_size = m_rom_gb.at(0x149);
-        switch (ram_size)
-        {
-        case 0x00:
-            m_ram_size = 0;
-            break;
-        case 0x01:
-            m_ram_size = 2048; // 2 KB
-            break;
-        case 0x02:
-            m_ram_size = 8192; // 8 KB
-            break;
-        case 0x03:
-            m_ram_size = 32'768; // 32 KB
-            break;
-        case 0x04:
-            m_ram_size = 131'072; // 128 KB
-            break;
-        case 0x05:
-            m_ram_size = 65'536; // 64 KB
-            break;
-        }
-
-        m_ext_ram.resize(m_ram_size);
+        m_boot_rom.fill(0x00);
+        std::copy_n(boot_rom.begin(), std::min(boot_rom.size(), m_boot_rom.size()), m_boot_rom.begin());
+    }
+
+    bool MMU::load_game_rom(std::string_view path, bool persist_battery)
+    {
+        auto rom = RomImage::open(path);
+        if (rom == nullptr)
+        {
+            return false;
+        }
+
+        m_insert_cartridge(std::move(rom), persist_battery ? std::filesystem::path{path}.replace_extension(".sav").string() : "");
+
+        return true;
+    }
+
+    void MMU::load_game_rom(std::shared_ptr<const RomImage> rom)
+    {
+        m_insert_cartridge(std::move(rom), "");
+    }
+
+    u32 MMU::cartridge_id()
+    {
+        if (m_rom == nullptr)
+        {
+            return 0;
+        }
+
+        const auto rom = m_rom->data();
+        return ((u32)rom[0x14D] << 16) | ((u32)rom[0x14E] << 8) | rom[0x14F];
+    }
+
+    void MMU::save_state(StateWriter& w)
+    {
+        w.put(vram);
+        w.put(wram);
+        w.put(oam);
+        w.put(io_reg);
+        w.put(hram);
+        w.put(internal_div);
+        w.put(ie_reg);
+        w.put(p_input);
+        w.put(boot_rom_enabled);
+        w.put(m_boot_rom);
+        w.put(m_dma_bus_conflict);
+        w.put(m_select_action);
+        w.put(m_select_direction);
+        scheduler.save_state(w);
+        m_mapper->save_state(w);
+    }
+
+    bool MMU::load_state(StateReader& r)
+    {
+        r.get_bytes(vram);
+        r.get_bytes(wram);
+        r.get_bytes(oam);
+        r.get_bytes(io_reg);
+        r.get_bytes(hram);
+        internal_div = r.get<u16>();
+        ie_reg = r.get<u8>();
+        p_input = r.get<std::array<bool, 8>>();
+        boot_rom_enabled = r.get<bool>();
+        r.get_bytes(m_boot_rom);
+        m_dma_bus_conflict = r.get<bool>();
+        m_select_action = r.get<bool>();
+        m_select_direction = r.get<bool>();
+        const bool valid = scheduler.load_state(r);
+        if (m_save != nullptr)
+        {
+            m_save->write([&] { m_mapper->load_state(r); });
+        }
+        else
+        {
+            m_mapper->load_state(r);
+        }
+
+        m_map_pages(0x00, 0xFF);
+
+        return valid;
+    }
+
+    void MMU::m_insert_cartridge(std::shared_ptr<const RomImage> rom, const std::string& save_path)
+    {
+        // The previous cartridge may still hold the same .sav
+        m_mapper = std::make_unique<NoMBC>(std::span<const u8>{}, std::span<u8>{});
+        m_save.reset();
+
+        // The clock state is saved after the RAM
+        const std::size_t ram_size = Mapper::ram_size(rom->data());
+        const std::size_t rtc_size = Mapper::rtc_equipped(rom->data()) ? RTC_SAVE_SIZE : 0;
+        if (!save_path.empty() && ram_size + rtc_size > 0 && Mapper::battery_backed(rom->data()))
+        {
+            // Volatile RAM if the .sav can't be used, the game still runs
+            m_save = SaveFile::open(save_path, ram_size + rtc_size);
+        }
+
+        std::span<u8> ext_ram;
+        std::span<u8> rtc_save;
+        if (m_save != nullptr)
+        {
+            ext_ram = m_save->data().first(ram_size);
+            rtc_save = m_save->data().subspan(ram_size);
+        }
+        else
+        {
+            m_ext_ram.assign(ram_size, 0);
+            ext_ram = m_ext_ram;
+        }
+
+        m_mapper = Mapper::create(rom->data(), ext_ram);
+        if (m_mapper->has_rtc)
+        {
+            m_mapper->rtc = std::make_unique<RTC>(rtc_mode, scheduler.now, rtc_save);
+        }
+        m_rom = std::move(rom);
+        m_map_pages(0x00, 0xFF);
     }
 
     // TO DO : impl DMA Bus Conflicts
     void MMU::oam_dma_transfer(u8 src)
     {
-        std::memcpy(oam.get(), get_host_adr(src << 8), 0xA0);
+        auto p = get_host_adr(src << 8);
+        if (p != nullptr)
+        {
+            std::memcpy(oam.data(), p, 0xA0);
+            return;
+        }
+
+        // Disabled or MBC2 external RAM
+        for (int i = 0; i < 0xA0; ++i)
+        {
+            oam.at(i) = read((src << 8) + i);
+        }
     }
 
     bool MMU::is_locked(u16 gb_adr)
@@ -1,8 +1,14 @@
 #pragma once
 #include "integers.h"
+#include "Mapper.h"
+#include "RomImage.h"
+#include "SaveState.h"
+#include "SaveFile.h"
+#include "Scheduler.h"
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <span>
 #include <string_view>
 #include <string>
 #include <vector>
@@ -83,6 +89,11 @@ namespace PGBE
         IE = 0xFF
     };
 
+    // Pseudo bank numbers of the cacheable code regions outside the cartridge, see MMU::code_bank
+    constexpr int CODE_BANK_BOOT_ROM = 0x1000;
+    constexpr int CODE_BANK_WRAM = 0x1001;
+    constexpr int CODE_BANK_HRAM = 0x1002;
+
     class Timer;
 
     class MMU
@@ -94,67 +105,69 @@ namespace PGBE
         void write(u16 adr, u8 v);
         u8* get_host_adr(u16 gb_adr);
         bool is_locked(u16 gb_adr);
+        // Bank of the memory mapped at gb_adr for the code cache, -1 if it can't be cached
+        int code_bank(u16 gb_adr);
 
         void reset();
+        // VRAM is not writable in mode 3, to call when the PPU mode changes
+        void map_vram();
 
         void oam_dma_transfer(u8 src);
 
         void load_boot_rom(std::string_view path);
-        void load_game_rom(std::string_view path);
-
-        std::unique_ptr<std::array<u8, 0x2000>> vram;
-        std::unique_ptr<std::array<u8, 0x2000>> wram;
-        std::unique_ptr<std::array<u8, 0x00A0>> oam;
-        std::unique_ptr<std::array<u8, 0x0080>> io_reg;
-        std::unique_ptr<std::array<u8, 0x007F>> hram;
+        void load_boot_rom(std::span<const u8> boot_rom);
+        // Keeps the current cartridge when the rom can't be loaded. With persist_battery,
+        // battery-backed RAM is kept in a .sav file next to the rom.
+        bool load_game_rom(std::string_view path, bool persist_battery = true);
+        // Battery-backed RAM isn't persisted
+        void load_game_rom(std::shared_ptr<const RomImage> rom);
+        // Header and global checksums of the cartridge, 0 without one
+        u32 cartridge_id();
+
+        // Memory, scheduler and cartridge state, loading returns false when the scheduler rejects it
+        void save_state(StateWriter& w);
+        bool load_state(StateReader& r);
+
+        // Held inline, a whole machine is a single allocation
+        std::array<u8, 0x2000> vram;
+        std::array<u8, 0x2000> wram;
+        std::array<u8, 0x00A0> oam;
+        std::array<u8, 0x0080> io_reg;
+        std::array<u8, 0x007F> hram;
         u16 internal_div;
         u8 ie_reg;
         Timer* timer;
+        Scheduler scheduler;
+        // Bytes written to SB are appended to it when set, printed otherwise
+        std::string* serial_log;
 
         std::array<bool, 8> p_input;
 
         bool boot_rom_enabled;
+        // Clock followed by the cartridge RTC, taken when a rom is loaded
+        rtc_clock rtc_mode;
     private:
-        std::unique_ptr<std::array<u8, 0x0100>> m_boot_rom;
-        std::vector<u8> m_rom_gb;
+        std::array<u8, 0x0100> m_boot_rom;
+        std::shared_ptr<const RomImage> m_rom;
         std::vector<u8> m_ext_ram;
+        // Replaces m_ext_ram when the RAM is persisted
+        std::unique_ptr<SaveFile> m_save;
 
         bool m_dma_bus_conflict;
 
         bool m_select_action;
         bool m_select_direction;
 
-        enum 
-        {
-            None, // plain rom
-            MBC1,
-            MBC2,
-            MBC3,
-            MBC5,
-            MBC6,
-            MBC7,
-            MMM01,
-            POCKET_CAMERA,
-            BANDAI_TAMA5,
-            HUC3,
-            HUC1,
-        }
-        m_mbc_type;
-        
-        int m_rom_bank_nb;
-        int m_ram_bank_nb;
-
-        int m_rom_size; // bank nb
-        int m_ram_size;
-        bool m_mode_flag;
-
-        bool m_has_ram;
-        bool m_has_battery_buffered_ram;
-        bool m_has_real_time_clock;
-        bool m_has_rumble;
-        bool m_has_accelerometer;
-
-        bool m_ext_ram_enabled;
+        std::unique_ptr<Mapper> m_mapper;
+
+        // Host memory of every 256 bytes guest page, nullptr when the access goes through the slow path
+        std::array<u8*, 0x100> m_read_pages;
+        std::array<u8*, 0x100> m_write_pages;
+
+        u8 m_read_slow(u16 adr);
+        void m_write_slow(u16 adr, u8 v);
+        void m_map_pages(int first, int last);
+        void m_insert_cartridge(std::shared_ptr<const RomImage> rom, const std::string& save_path);
 
         STAT_REG& m_STAT;
     };
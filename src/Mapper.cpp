@@ -0,0 +1,446 @@
+#include "Mapper.h"
+#include <algorithm>
+#include <cstddef>
+
+namespace PGBE
+{
+    Mapper::Mapper(std::span<const u8> rom_gb, std::span<u8> ext_ram) :
+        ram(nullptr),
+        ram_mask((u16)(std::min<std::size_t>(ext_ram.size(), 0x2000) - 1)),
+        has_battery(false),
+        has_rtc(false),
+        has_rumble(false),
+        m_rom(rom_gb),
+        m_ram(ext_ram)
+    {
+        rom_lo = m_rom_bank(0);
+        rom_hi = m_rom_bank(1);
+    }
+
+    std::unique_ptr<Mapper> Mapper::create(std::span<const u8> rom_gb, std::span<u8> ext_ram)
+    {
+        const u8 type = rom_gb[0x147];
+
+        std::unique_ptr<Mapper> mapper;
+        switch (type)
+        {
+        case 0x01:
+        case 0x02:
+        case 0x03:
+        {
+            // 8 Mbit multicarts repeat the Nintendo logo at the start of every game
+            const std::size_t game_2 = 0x10 * 0x4000;
+            const bool multicart = (rom_gb.size() == 64 * 0x4000)
+                && std::equal(rom_gb.begin() + 0x104, rom_gb.begin() + 0x134, rom_gb.begin() + game_2 + 0x104);
+
+            mapper = std::make_unique<MBC1>(rom_gb, ext_ram, multicart);
+            break;
+        }
+        case 0x05:
+        case 0x06:
+            mapper = std::make_unique<MBC2>(rom_gb, ext_ram);
+            break;
+        case 0x0F:
+        case 0x10:
+        case 0x11:
+        case 0x12:
+        case 0x13:
+            mapper = std::make_unique<MBC3>(rom_gb, ext_ram);
+            break;
+        case 0x19:
+        case 0x1A:
+        case 0x1B:
+        case 0x1C:
+        case 0x1D:
+        case 0x1E:
+            mapper = std::make_unique<MBC5>(rom_gb, ext_ram);
+            mapper->has_rumble = (type >= 0x1C);
+            break;
+        default:
+            // MMM01, MBC6, MBC7, HuC and the camera aren't emulated, their first 2 banks are
+            mapper = std::make_unique<NoMBC>(rom_gb, ext_ram);
+            break;
+        }
+
+        mapper->has_battery = battery_backed(rom_gb);
+        mapper->has_rtc = rtc_equipped(rom_gb);
+
+        return mapper;
+    }
+
+    std::size_t Mapper::ram_size(std::span<const u8> rom_gb)
+    {
+        const u8 type = rom_gb[0x147];
+        if (type == 0x05 || type == 0x06)
+        {
+            return 512; // built into MBC2
+        }
+
+        switch (rom_gb[0x149])
+        {
+        case 0x01:
+            return 2048; // 2 KB
+        case 0x02:
+            return 8192; // 8 KB
+        case 0x03:
+            return 32'768; // 32 KB
+        case 0x04:
+            return 131'072; // 128 KB
+        case 0x05:
+            return 65'536; // 64 KB
+        }
+
+        return 0;
+    }
+
+    bool Mapper::battery_backed(std::span<const u8> rom_gb)
+    {
+        switch (rom_gb[0x147])
+        {
+        case 0x03:
+        case 0x06:
+        case 0x09:
+        case 0x0D:
+        case 0x0F:
+        case 0x10:
+        case 0x13:
+        case 0x1B:
+        case 0x1E:
+        case 0x22:
+        case 0xFF:
+            return true;
+        }
+
+        return false;
+    }
+
+    bool Mapper::rtc_equipped(std::span<const u8> rom_gb)
+    {
+        return rom_gb[0x147] == 0x0F || rom_gb[0x147] == 0x10;
+    }
+
+    void Mapper::write(u16 adr, u8 v)
+    {
+    }
+
+    u8 Mapper::read_ram(u16 adr)
+    {
+        return 0xFF;
+    }
+
+    void Mapper::write_ram(u16 adr, u8 v)
+    {
+    }
+
+    void Mapper::save_state(StateWriter& w)
+    {
+        w.put_bytes(m_ram);
+        if (rtc != nullptr)
+        {
+            rtc->save_state(w);
+        }
+    }
+
+    void Mapper::load_state(StateReader& r)
+    {
+        r.get_bytes(m_ram);
+        if (rtc != nullptr)
+        {
+            rtc->load_state(r);
+        }
+    }
+
+    const u8* Mapper::m_rom_bank(int nb)
+    {
+        if (m_rom.empty())
+        {
+            return nullptr;
+        }
+
+        // Bank numbers wrap around the rom size
+        nb %= (int)(m_rom.size() / 0x4000);
+
+        return m_rom.data() + nb * 0x4000;
+    }
+
+    u8* Mapper::m_ram_bank(int nb)
+    {
+        if (m_ram.empty())
+        {
+            return nullptr;
+        }
+
+        return m_ram.data() + (nb * 0x2000) % m_ram.size();
+    }
+
+    NoMBC::NoMBC(std::span<const u8> rom_gb, std::span<u8> ext_ram) :
+        Mapper(rom_gb, ext_ram)
+    {
+        ram = m_ram_bank(0);
+    }
+
+    MBC1::MBC1(std::span<const u8> rom_gb, std::span<u8> ext_ram, bool multicart) :
+        Mapper(rom_gb, ext_ram),
+        m_multicart(multicart),
+        m_ram_enabled(false),
+        m_bank1(1),
+        m_bank2(0),
+        m_mode(false)
+    {
+        m_update();
+    }
+
+    void MBC1::write(u16 adr, u8 v)
+    {
+        if (adr <= 0x1FFF) // RAMG
+        {
+            m_ram_enabled = ((v & 0x0F) == 0x0A);
+        }
+        else if (adr <= 0x3FFF) // BANK1, 0 is read as 1
+        {
+            m_bank1 = v & 0b0001'1111;
+            if (m_bank1 == 0)
+            {
+                m_bank1 = 1;
+            }
+        }
+        else if (adr <= 0x5FFF) // BANK2
+        {
+            m_bank2 = v & 0b11;
+        }
+        else // MODE
+        {
+            m_mode = ((v & 0b1) == 1);
+        }
+
+        m_update();
+    }
+
+    void MBC1::save_state(StateWriter& w)
+    {
+        Mapper::save_state(w);
+        w.put(m_ram_enabled);
+        w.put(m_bank1);
+        w.put(m_bank2);
+        w.put(m_mode);
+    }
+
+    void MBC1::load_state(StateReader& r)
+    {
+        Mapper::load_state(r);
+        m_ram_enabled = r.get<bool>();
+        // Masked to the register widths, a corrupted state can't map memory outside of the cartridge
+        m_bank1 = r.get<int>() & 0b0001'1111;
+        m_bank2 = r.get<int>() & 0b11;
+        m_mode = r.get<bool>();
+        m_update();
+    }
+
+    void MBC1::m_update()
+    {
+        const int shift = m_multicart ? 4 : 5;
+        const int bank1 = m_multicart ? (m_bank1 & 0b1111) : m_bank1;
+
+        // BANK2 also drives the upper bits of the 0x0000 bank and the RAM bank in mode 1
+        rom_lo = m_rom_bank(m_mode ? (m_bank2 << shift) : 0);
+        rom_hi = m_rom_bank((m_bank2 << shift) | bank1);
+        ram = m_ram_enabled ? m_ram_bank(m_mode ? m_bank2 : 0) : nullptr;
+    }
+
+    MBC2::MBC2(std::span<const u8> rom_gb, std::span<u8> ext_ram) :
+        Mapper(rom_gb, ext_ram),
+        m_ram_enabled(false),
+        m_rom_bank_nb(1)
+    {
+    }
+
+    void MBC2::write(u16 adr, u8 v)
+    {
+        if (adr > 0x3FFF)
+        {
+            return;
+        }
+
+        // Bit 8 of the address selects the register
+        if ((adr & 0x100) == 0)
+        {
+            m_ram_enabled = ((v & 0x0F) == 0x0A);
+        }
+        else
+        {
+            m_rom_bank_nb = ((v & 0x0F) == 0) ? 1 : (v & 0x0F);
+            rom_hi = m_rom_bank(m_rom_bank_nb);
+        }
+    }
+
+    u8 MBC2::read_ram(u16 adr)
+    {
+        if (!m_ram_enabled)
+        {
+            return 0xFF;
+        }
+
+        return 0xF0 | m_ram[adr & 0x1FF];
+    }
+
+    void MBC2::write_ram(u16 adr, u8 v)
+    {
+        if (m_ram_enabled)
+        {
+            m_ram[adr & 0x1FF] = (v & 0x0F);
+        }
+    }
+
+    void MBC2::save_state(StateWriter& w)
+    {
+        Mapper::save_state(w);
+        w.put(m_ram_enabled);
+        w.put(m_rom_bank_nb);
+    }
+
+    void MBC2::load_state(StateReader& r)
+    {
+        Mapper::load_state(r);
+        m_ram_enabled = r.get<bool>();
+        m_rom_bank_nb = r.get<int>() & 0x0F;
+        rom_hi = m_rom_bank(m_rom_bank_nb);
+    }
+
+    MBC3::MBC3(std::span<const u8> rom_gb, std::span<u8> ext_ram) :
+        Mapper(rom_gb, ext_ram),
+        m_ram_enabled(false),
+        m_rom_bank_nb(1),
+        m_ram_bank_nb(0),
+        m_latch_armed(false)
+    {
+        m_update();
+    }
+
+    void MBC3::write(u16 adr, u8 v)
+    {
+        if (adr <= 0x1FFF) // also enables the clock
+        {
+            m_ram_enabled = ((v & 0x0F) == 0x0A);
+        }
+        else if (adr <= 0x3FFF)
+        {
+            m_rom_bank_nb = v & 0x7F;
+            if (m_rom_bank_nb == 0)
+            {
+                m_rom_bank_nb = 1;
+            }
+        }
+        else if (adr <= 0x5FFF)
+        {
+            m_ram_bank_nb = v;
+        }
+        else // latch clock data
+        {
+            if (m_latch_armed && v == 0x01 && rtc != nullptr)
+            {
+                rtc->latch();
+            }
+            m_latch_armed = (v == 0x00);
+        }
+
+        m_update();
+    }
+
+    u8 MBC3::read_ram(u16 adr)
+    {
+        if (!m_ram_enabled || rtc == nullptr || m_ram_bank_nb < 0x08 || m_ram_bank_nb > 0x0C)
+        {
+            return 0xFF;
+        }
+
+        return rtc->read(m_ram_bank_nb);
+    }
+
+    void MBC3::write_ram(u16 adr, u8 v)
+    {
+        if (m_ram_enabled && rtc != nullptr && 0x08 <= m_ram_bank_nb && m_ram_bank_nb <= 0x0C)
+        {
+            rtc->write(m_ram_bank_nb, v);
+        }
+    }
+
+    void MBC3::save_state(StateWriter& w)
+    {
+        Mapper::save_state(w);
+        w.put(m_ram_enabled);
+        w.put(m_rom_bank_nb);
+        w.put(m_ram_bank_nb);
+        w.put(m_latch_armed);
+    }
+
+    void MBC3::load_state(StateReader& r)
+    {
+        Mapper::load_state(r);
+        m_ram_enabled = r.get<bool>();
+        m_rom_bank_nb = r.get<int>() & 0x7F;
+        m_ram_bank_nb = r.get<int>() & 0xFF;
+        m_latch_armed = r.get<bool>();
+        m_update();
+    }
+
+    void MBC3::m_update()
+    {
+        rom_hi = m_rom_bank(m_rom_bank_nb);
+        ram = (m_ram_enabled && m_ram_bank_nb <= 0x03) ? m_ram_bank(m_ram_bank_nb) : nullptr;
+    }
+
+    MBC5::MBC5(std::span<const u8> rom_gb, std::span<u8> ext_ram) :
+        Mapper(rom_gb, ext_ram),
+        m_ram_enabled(false),
+        m_rom_bank_nb(1),
+        m_ram_bank_nb(0)
+    {
+        m_update();
+    }
+
+    void MBC5::write(u16 adr, u8 v)
+    {
+        if (adr <= 0x1FFF)
+        {
+            m_ram_enabled = ((v & 0x0F) == 0x0A);
+        }
+        else if (adr <= 0x2FFF) // bits 0-7, bank 0 can be selected
+        {
+            m_rom_bank_nb = (m_rom_bank_nb & 0x100) | v;
+        }
+        else if (adr <= 0x3FFF) // bit 8
+        {
+            m_rom_bank_nb = (m_rom_bank_nb & 0xFF) | ((v & 0x01) << 8);
+        }
+        else if (adr <= 0x5FFF)
+        {
+            // Bit 3 drives the rumble motor instead
+            m_ram_bank_nb = v & (has_rumble ? 0x07 : 0x0F);
+        }
+
+        m_update();
+    }
+
+    void MBC5::save_state(StateWriter& w)
+    {
+        Mapper::save_state(w);
+        w.put(m_ram_enabled);
+        w.put(m_rom_bank_nb);
+        w.put(m_ram_bank_nb);
+    }
+
+    void MBC5::load_state(StateReader& r)
+    {
+        Mapper::load_state(r);
+        m_ram_enabled = r.get<bool>();
+        m_rom_bank_nb = r.get<int>() & 0x1FF;
+        m_ram_bank_nb = r.get<int>() & 0x0F;
+        m_update();
+    }
+
+    void MBC5::m_update()
+    {
+        rom_hi = m_rom_bank(m_rom_bank_nb);
+        ram = m_ram_enabled ? m_ram_bank(m_ram_bank_nb) : nullptr;
+    }
+}
\ No newline at end of file
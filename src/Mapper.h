@@ -0,0 +1,132 @@
+#pragma once
+#include "integers.h"
+#include "RTC.h"
+#include <cstddef>
+#include <memory>
+#include <span>
+
+namespace PGBE
+{
+    // Cartridge memory bank controller. The host memory mapped in the cartridge areas is
+    // cached in rom_lo/rom_hi/ram and only recomputed when a control register is written.
+    class Mapper
+    {
+    public:
+        Mapper(std::span<const u8> rom_gb, std::span<u8> ext_ram);
+        virtual ~Mapper() = default;
+
+        // Reads the cartridge header to pick the controller, ext_ram is ram_size() bytes
+        // rom_gb is made of whole banks, at least 2, as RomImage hands them out
+        static std::unique_ptr<Mapper> create(std::span<const u8> rom_gb, std::span<u8> ext_ram);
+        // Cartridge RAM size from the header
+        static std::size_t ram_size(std::span<const u8> rom_gb);
+        // Whether the cartridge RAM, or the clock, is kept when powered off
+        static bool battery_backed(std::span<const u8> rom_gb);
+        // MBC3 with a real time clock
+        static bool rtc_equipped(std::span<const u8> rom_gb);
+
+        // Control register write, 0x0000-0x7FFF
+        virtual void write(u16 adr, u8 v);
+        // External RAM accesses while ram is nullptr
+        virtual u8 read_ram(u16 adr);
+        virtual void write_ram(u16 adr, u8 v);
+
+        // RAM, clock and bank registers
+        virtual void save_state(StateWriter& w);
+        virtual void load_state(StateReader& r);
+
+        const u8* rom_lo; // 0x0000-0x3FFF, nullptr without a cartridge
+        const u8* rom_hi; // 0x4000-0x7FFF, nullptr without a cartridge
+        u8* ram; // 0xA000-0xBFFF, nullptr when disabled or not plain memory
+        u16 ram_mask; // RAM smaller than 8 KB is mirrored over the whole area
+
+        bool has_battery;
+        bool has_rtc;
+        bool has_rumble;
+        // Attached by the MMU when has_rtc
+        std::unique_ptr<RTC> rtc;
+    protected:
+        const u8* m_rom_bank(int nb);
+        u8* m_ram_bank(int nb);
+
+        std::span<const u8> m_rom;
+        std::span<u8> m_ram;
+    };
+
+    class NoMBC : public Mapper
+    {
+    public:
+        NoMBC(std::span<const u8> rom_gb, std::span<u8> ext_ram);
+    };
+
+    class MBC1 : public Mapper
+    {
+    public:
+        // A multicart (MBC1M) wires only 4 bits of BANK1, BANK2 selects one of its 4 games
+        MBC1(std::span<const u8> rom_gb, std::span<u8> ext_ram, bool multicart);
+
+        void write(u16 adr, u8 v) override;
+        void save_state(StateWriter& w) override;
+        void load_state(StateReader& r) override;
+    private:
+        void m_update();
+
+        bool m_multicart;
+        bool m_ram_enabled;
+        int m_bank1;
+        int m_bank2;
+        bool m_mode;
+    };
+
+    class MBC2 : public Mapper
+    {
+    public:
+        MBC2(std::span<const u8> rom_gb, std::span<u8> ext_ram);
+
+        void write(u16 adr, u8 v) override;
+        // 512 half-bytes, the upper half reads as 1s
+        u8 read_ram(u16 adr) override;
+        void write_ram(u16 adr, u8 v) override;
+        void save_state(StateWriter& w) override;
+        void load_state(StateReader& r) override;
+    private:
+        bool m_ram_enabled;
+        int m_rom_bank_nb;
+    };
+
+    class MBC3 : public Mapper
+    {
+    public:
+        MBC3(std::span<const u8> rom_gb, std::span<u8> ext_ram);
+
+        void write(u16 adr, u8 v) override;
+        // RAM banks 0x08-0x0C select the clock registers
+        u8 read_ram(u16 adr) override;
+        void write_ram(u16 adr, u8 v) override;
+        void save_state(StateWriter& w) override;
+        void load_state(StateReader& r) override;
+    private:
+        void m_update();
+
+        bool m_ram_enabled;
+        int m_rom_bank_nb;
+        int m_ram_bank_nb;
+        bool m_latch_armed; // 0x00 written to the latch register, 0x01 latches
+    };
+
+    class MBC5 : public Mapper
+    {
+    public:
+        MBC5(std::span<const u8> rom_gb, std::span<u8> ext_ram);
+
+        void write(u16 adr, u8 v) override;
+        void save_state(StateWriter& w) override;
+        void load_state(StateReader& r) override;
+    private:
+        void m_update();
+
+        bool m_ram_enabled;
+        int m_rom_bank_nb;
+        int m_ram_bank_nb;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "Movie.h"
+#include "SaveState.h"
+#include <fmt/core.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace PGBE
+{
+    // A movie file is this header, the state it starts from then its inputs, raw in host byte order
+    constexpr u32 MOVIE_MAGIC = 0x4D424750; // "PGBM"
+    constexpr u32 MOVIE_VERSION = 1;
+
+    struct movie_header
+    {
+        u32 magic;
+        u32 version;
+        u64 length; // frames
+        u64 state_size;
+        u64 input_count;
+    };
+
+    constexpr std::size_t INPUT_SIZE = 2 * sizeof(u64) + 2;
+
+    Movie::Movie() :
+        m_mode(MOVIE_STOPPED),
+        m_start(),
+        m_inputs(),
+        m_next(0),
+        m_frame(0),
+        m_length(0),
+        m_desynced(false)
+    {
+    }
+
+    void Movie::start_recording(GameBoy& gb)
+    {
+        // The first frame run draws the screen again
+        m_start.resize(gb.state_size());
+        gb.save_state(m_start, false);
+
+        m_inputs.clear();
+        m_frame = 0;
+        m_length = 0;
+        m_desynced = false;
+        m_mode = MOVIE_RECORDING;
+    }
+
+    void Movie::record(GameBoy& gb, GB_BUTTON b, bool pressed)
+    {
+        if (m_mode != MOVIE_RECORDING)
+        {
+            return;
+        }
+
+        m_inputs.push_back(button_change{ .frame = m_frame, .cycle = gb.cpu.cycles(), .button = (u8)b, .pressed = pressed });
+    }
+
+    bool Movie::start_replay(GameBoy& gb)
+    {
+        if (m_start.empty() || !gb.load_state(m_start))
+        {
+            return false;
+        }
+
+        m_next = 0;
+        m_frame = 0;
+        m_desynced = false;
+        m_mode = MOVIE_PLAYING;
+
+        return true;
+    }
+
+    void Movie::stop()
+    {
+        if (m_mode == MOVIE_RECORDING)
+        {
+            m_length = m_frame;
+        }
+
+        m_mode = MOVIE_STOPPED;
+    }
+
+    void Movie::apply(GameBoy& gb)
+    {
+        if (m_mode != MOVIE_PLAYING)
+        {
+            return;
+        }
+
+        for (; m_next < m_inputs.size() && m_inputs[m_next].frame == m_frame; ++m_next)
+        {
+            const button_change& in = m_inputs[m_next];
+            if (in.cycle != gb.cpu.cycles() && !m_desynced)
+            {
+                fmt::print("Movie desync on frame {} : M-cycle {} instead of {}...\n", m_frame, gb.cpu.cycles(), in.cycle);
+                m_desynced = true;
+            }
+
+            gb.use_button((GB_BUTTON)in.button, in.pressed);
+        }
+    }
+
+    void Movie::frame_completed()
+    {
+        if (m_mode == MOVIE_STOPPED)
+        {
+            return;
+        }
+
+        ++m_frame;
+        if (m_mode == MOVIE_PLAYING && m_frame >= m_length)
+        {
+            m_mode = MOVIE_STOPPED;
+        }
+    }
+
+    bool Movie::save(std::string_view path) const
+    {
+        const movie_header header
+        {
+            .magic = MOVIE_MAGIC,
+            .version = MOVIE_VERSION,
+            .length = m_length,
+            .state_size = m_start.size(),
+            .input_count = m_inputs.size()
+        };
+
+        std::vector<u8> file(sizeof(header) + m_start.size() + m_inputs.size() * INPUT_SIZE);
+        StateWriter w(file);
+        w.put(header);
+        w.put_bytes(m_start);
+        for (const button_change& in : m_inputs)
+        {
+            w.put(in.frame);
+            w.put(in.cycle);
+            w.put(in.button);
+            w.put(in.pressed);
+        }
+
+        std::ofstream output(std::string{path}, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(file.data()), file.size());
+        if (!output)
+        {
+            fmt::print("Can't write movie {}...\n", path);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Movie::load(std::string_view path)
+    {
+        std::ifstream input(std::string{path}, std::ios::binary);
+        const std::vector<u8> file((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        StateReader r(file);
+        const auto header = r.get<movie_header>();
+        if (!input || header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION)
+        {
+            fmt::print("Not a movie of this version {}...\n", path);
+            return false;
+        }
+
+        if (header.state_size > file.size() || header.input_count > file.size() / INPUT_SIZE
+            || file.size() != sizeof(header) + header.state_size + header.input_count * INPUT_SIZE)
+        {
+            fmt::print("Truncated movie {}...\n", path);
+            return false;
+        }
+
+        stop();
+        m_start.resize(header.state_size);
+        r.get_bytes(m_start);
+
+        m_inputs.resize(header.input_count);
+        for (button_change& in : m_inputs)
+        {
+            in.frame = r.get<u64>();
+            in.cycle = r.get<u64>();
+            in.button = r.get<u8>() & 7;
+            in.pressed = r.get<bool>();
+        }
+
+        m_length = header.length;
+        m_frame = 0;
+        m_next = 0;
+        m_desynced = false;
+
+        return true;
+    }
+
+    movie_mode Movie::mode() const
+    {
+        return m_mode;
+    }
+
+    u64 Movie::frame() const
+    {
+        return m_frame;
+    }
+
+    u64 Movie::length() const
+    {
+        return (m_mode == MOVIE_RECORDING) ? m_frame : m_length;
+    }
+
+    bool Movie::desynced() const
+    {
+        return m_desynced;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+#include "GameBoy.h"
+#include "integers.h"
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace PGBE
+{
+    enum movie_mode
+    {
+        MOVIE_STOPPED,
+        MOVIE_RECORDING,
+        MOVIE_PLAYING,
+    };
+
+    // Button changes from a save state on, each one tagged with the frame it was made before and the
+    // M-cycle that frame started at. Replaying them from that state gives the same machine, bit for bit.
+    class Movie
+    {
+    public:
+        Movie();
+
+        // Takes the state the movie starts from, the inputs are then added by record()
+        void start_recording(GameBoy& gb);
+        // To call after gb.use_button()
+        void record(GameBoy& gb, GB_BUTTON b, bool pressed);
+        // Loads the state the movie starts from into gb, false when it is for another cartridge
+        bool start_replay(GameBoy& gb);
+        void stop();
+
+        // Gives the inputs of the frame about to run while playing, to call before every frame
+        void apply(GameBoy& gb);
+        // To call after every frame, playing stops after the last frame recorded
+        void frame_completed();
+
+        bool save(std::string_view path) const;
+        bool load(std::string_view path);
+
+        movie_mode mode() const;
+        // Frames since the start, and recorded
+        u64 frame() const;
+        u64 length() const;
+        // An input wasn't given on the M-cycle it was recorded at
+        bool desynced() const;
+    private:
+        struct button_change
+        {
+            u64 frame;
+            u64 cycle;
+            u8 button;
+            bool pressed;
+        };
+
+        movie_mode m_mode;
+        std::vector<u8> m_start; // save state
+        std::vector<button_change> m_inputs;
+        std::size_t m_next; // next input to give while playing
+        u64 m_frame;
+        u64 m_length;
+        bool m_desynced;
+    };
+}
\ No newline at end of file
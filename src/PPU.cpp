@@ -5,94 +5,195 @@
 namespace PGBE
 {
     PPU::PPU(MMU* mmu) :
-        m_LCDC((LCD_C&)mmu->io_reg->at(LCDC)),
-        m_STAT((STAT_REG&)mmu->io_reg->at(STAT)),
-        m_LY(mmu->io_reg->at(LY)),
-        m_LYC(mmu->io_reg->at(LYC)),
-        m_SCX(mmu->io_reg->at(SCX)),
-        m_SCY(mmu->io_reg->at(SCY)),
-        m_IF(mmu->io_reg->at(IF)),
-        m_WX(mmu->io_reg->at(WX)),
-        m_WY(mmu->io_reg->at(WY)),
-        m_BGP(mmu->io_reg->at(BGP)),
-        m_OBP0(mmu->io_reg->at(OBP0)),
-        m_OBP1(mmu->io_reg->at(OBP1)),
-        m_oam(*(mmu->oam)),
-        m_vram(*(mmu->vram)),
+        m_mmu(mmu),
+        m_LCDC((LCD_C&)mmu->io_reg.at(LCDC)),
+        m_STAT((STAT_REG&)mmu->io_reg.at(STAT)),
+        m_LY(mmu->io_reg.at(LY)),
+        m_LYC(mmu->io_reg.at(LYC)),
+        m_SCX(mmu->io_reg.at(SCX)),
+        m_SCY(mmu->io_reg.at(SCY)),
+        m_IF(mmu->io_reg.at(IF)),
+        m_WX(mmu->io_reg.at(WX)),
+        m_WY(mmu->io_reg.at(WY)),
+        m_BGP(mmu->io_reg.at(BGP)),
+        m_OBP0(mmu->io_reg.at(OBP0)),
+        m_OBP1(mmu->io_reg.at(OBP1)),
+        m_oam(mmu->oam),
+        m_vram(mmu->vram),
+        m_scheduler(mmu->scheduler),
         m_window_line_counter(0),
+        m_line_start(0),
         m_cur_cycle_in_scanline(0),
+        m_enabled(false),
         m_frame_completed(false),
         m_stat_triggered(false),
         m_state(H_BLANK),
         m_drawing_cycle_nb(172),
-        framebuffer(nullptr)
+        framebuffer(nullptr),
+        render(true)
     {
         m_sprite_buffer.reserve(10);
         m_STAT.unused = 1;
     }
 
-    void PPU::tick()
+    // Only the T-cycle after something the STAT interrupt or the LCD state depends on
+    // changed can differ from the previous one, so this runs on that T-cycle alone
+    void PPU::check_lcd()
     {
         m_check_stat();
 
         if (m_LCDC.ppu_enable == 0)
         {
+            if (m_enabled)
+            {
+                // The position in the scanline is kept until the LCD is switched back on
+                m_cur_cycle_in_scanline = (int)(m_scheduler.now - 1 - m_line_start);
+                m_scheduler.cancel(EVENT_PPU_MODE);
+                m_enabled = false;
+            }
+
             return;
         }
 
-        m_cur_cycle_in_scanline++;
+        if (!m_enabled)
+        {
+            m_enabled = true;
+            m_line_start = m_scheduler.now - m_cur_cycle_in_scanline - 1;
+            m_schedule_mode_end(m_scheduler.now);
+        }
+    }
+
+    void PPU::save_state(StateWriter& w, bool with_framebuffer)
+    {
+        w.put(m_line_start);
+        w.put(m_cur_cycle_in_scanline);
+        w.put(m_enabled);
+        w.put(m_window_line_counter);
+        w.put(m_drawing_cycle_nb);
+        w.put(m_frame_completed);
+        w.put(m_stat_triggered);
+        w.put((u8)m_state);
+
+        // The frame drawn so far
+        if (with_framebuffer && framebuffer != nullptr)
+        {
+            w.put(*framebuffer);
+        }
+        else
+        {
+            w.put_zeros(sizeof(*framebuffer));
+        }
+    }
+
+    void PPU::load_state(StateReader& r, bool with_framebuffer)
+    {
+        m_line_start = r.get<u64>();
+        m_cur_cycle_in_scanline = r.get<int>();
+        m_enabled = r.get<bool>();
+        m_window_line_counter = r.get<int>();
+        m_drawing_cycle_nb = r.get<int>();
+        m_frame_completed = r.get<bool>();
+        m_stat_triggered = r.get<bool>();
+        m_state = (state)r.get<u8>();
+
+        if (with_framebuffer && framebuffer != nullptr)
+        {
+            r.get_bytes({ reinterpret_cast<u8*>(framebuffer->data()), sizeof(*framebuffer) });
+        }
+        else
+        {
+            r.skip(sizeof(*framebuffer));
+        }
+    }
 
+    void PPU::next_mode()
+    {
         switch (m_state)
         {
         case OAM_SCAN:
-            if (m_cur_cycle_in_scanline >= 80)
-            {
-                m_switch_mode(DRAWING);
-            }
+            m_switch_mode(DRAWING);
             break;
         case DRAWING:
-            if (m_cur_cycle_in_scanline >= m_drawing_cycle_nb)
-            {
-                m_switch_mode(H_BLANK);
-            }
+            m_switch_mode(H_BLANK);
             break;
         case H_BLANK:
-            if (m_cur_cycle_in_scanline >= SCANLINE_DURATION)
-            {
-                m_cur_cycle_in_scanline = 0;
+            m_line_start = m_scheduler.now;
 
-                m_draw_scanline();
-
-                if (++m_LY >= NB_SCANLINES - 10)
-                {
-                    m_switch_mode(V_BLANK);
-                }
-                else
-                {
-                    m_switch_mode(OAM_SCAN);
-                }
+            m_draw_scanline();
 
-                m_check_coincidence();
-                m_stat_triggered = false;
+            if (++m_LY >= NB_SCANLINES - 10)
+            {
+                m_switch_mode(V_BLANK);
             }
-            break;
-        case V_BLANK:
-            if (m_cur_cycle_in_scanline >= SCANLINE_DURATION)
+            else
             {
-                m_cur_cycle_in_scanline = 0;
-                ++m_LY;
+                m_switch_mode(OAM_SCAN);
             }
 
+            m_check_coincidence();
+            m_stat_triggered = false;
+            break;
+        case V_BLANK:
+            m_line_start = m_scheduler.now;
+            ++m_LY;
+
             if (m_LY >= NB_SCANLINES)
             {
                 m_frame_completed = true;
             }
             break;
         }
+
+        m_schedule_mode_end(m_scheduler.now + 1);
+        m_schedule_check();
+    }
+
+    void PPU::m_schedule_check()
+    {
+        m_scheduler.schedule(m_scheduler.now + 1, PHASE_STAT, EVENT_PPU_STAT);
+    }
+
+    void PPU::m_schedule_mode_end(u64 earliest)
+    {
+        int end = SCANLINE_DURATION;
+        if (m_state == OAM_SCAN)
+        {
+            // Mode 3 shows 88 T-cycles after the mode 2 interrupt, reads see the PPU at the end of
+            // their M-cycle instead of its start so it has to come one M-cycle later here
+            end = 92;
+        }
+        else if (m_state == DRAWING)
+        {
+            end = m_drawing_cycle_nb;
+        }
+
+        // Ends on the T-cycle the position in the scanline reaches end, right after the STAT check
+        m_scheduler.schedule(std::max(m_line_start + end, earliest), PHASE_PPU, EVENT_PPU_MODE);
+    }
+
+    bool PPU::m_window_on_line()
+    {
+        return (m_LCDC.win_enable == 1) &&
+            (m_LCDC.bg_win_enable == 1) &&
+            ((m_WX - 7) < 160) &&
+            (m_WY < 144) &&
+            (m_LY >= m_WY);
     }
 
     void PPU::m_draw_scanline()
     {
+        const bool win_on_line = m_window_on_line();
+
+        // Only the window line counter outlives the scanline
+        if (!render)
+        {
+            if (win_on_line)
+            {
+                m_window_line_counter++;
+            }
+            return;
+        }
+
         bool increase_win = false;
         int bg_pal_idx = 0;
 
@@ -122,12 +223,7 @@ namespace PGBE
 
         for (int x_pos = 0; x_pos < GB_VIEWPORT_WIDTH; ++x_pos)
         {
-            bool should_fetch_win =
-                (m_LCDC.win_enable == 1) &&
-                (m_LCDC.bg_win_enable == 1) &&
-                ((m_WX - 7) < 160) &&
-                (m_WY < 144) &&
-                (m_LY >= m_WY) &&
+            bool should_fetch_win = win_on_line &&
                 ((m_WX < 8) || ((m_WX > 7) && (x_pos >= (m_WX - 7))));
 
             // win
@@ -284,6 +380,7 @@ namespace PGBE
 
         m_state = new_state;
         m_STAT.ppu_mode = new_state;
+        m_mmu->map_vram();
     }
 
     bool PPU::frame_completed()
@@ -297,7 +394,20 @@ namespace PGBE
         m_LY = 0;
         m_frame_completed = false;
         m_window_line_counter = 0;
-        framebuffer->fill(color{.r = 0, .g = 0, .b = 0});
+
+        if (render)
+        {
+            framebuffer->fill(color{.r = 0, .g = 0, .b = 0});
+        }
+
+        // The scanline position isn't reset, OAM scan is only as long as what is left of its T-cycles
+        if (m_enabled)
+        {
+            m_scheduler.cancel(EVENT_PPU_MODE);
+            m_schedule_mode_end(m_scheduler.now + 1);
+        }
+
+        m_schedule_check();
     }
 
     void PPU::m_check_stat()
@@ -308,13 +418,7 @@ namespace PGBE
             return;
         }
 
-        bool any_condition_met =
-            ((m_STAT.coincidence_flag == 1) && (m_STAT.lcy_ly_interupt == 1))
-            || ((m_state == OAM_SCAN) && (m_STAT.mode_2_interupt == 1))
-            || ((m_state == H_BLANK) && (m_STAT.mode_0_interupt == 1))
-            || ((m_state == V_BLANK) && ((m_STAT.mode_1_interupt == 1) || (m_STAT.mode_2_interupt == 1)));
-
-        if (any_condition_met)
+        if (m_stat_condition())
         {
             if (!m_stat_triggered)
             {
@@ -329,6 +433,14 @@ namespace PGBE
         }
     }
 
+    bool PPU::m_stat_condition()
+    {
+        return ((m_STAT.coincidence_flag == 1) && (m_STAT.lcy_ly_interupt == 1))
+            || ((m_state == OAM_SCAN) && (m_STAT.mode_2_interupt == 1))
+            || ((m_state == H_BLANK) && (m_STAT.mode_0_interupt == 1))
+            || ((m_state == V_BLANK) && ((m_STAT.mode_1_interupt == 1) || (m_STAT.mode_2_interupt == 1)));
+    }
+
     void PPU::m_check_coincidence()
     {
         if (m_LCDC.ppu_enable == 0)
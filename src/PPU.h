@@ -107,12 +107,24 @@ namespace PGBE
     public:
         PPU(MMU* mmu);
 
-        void tick();
         void reset();
         bool frame_completed();
+        // EVENT_PPU_MODE handler
+        void next_mode();
+        // EVENT_PPU_STAT handler
+        void check_lcd();
+
+        // The registers, VRAM and OAM are saved with the MMU
+        // Without the framebuffer its place is filled with 0s
+        void save_state(StateWriter& w, bool with_framebuffer);
+        void load_state(StateReader& r, bool with_framebuffer);
 
         std::array<color, FRAMEBUFFER_SIZE>* framebuffer;
+        // Off, the frames run without a pixel drawn : same timing, registers and interrupts.
+        // The framebuffer is left as it is and can be null.
+        bool render;
     private:
+        MMU* m_mmu;
         LCD_C& m_LCDC;
         STAT_REG& m_STAT;
         u8& m_LY, & m_SCX, & m_SCY,
@@ -124,7 +136,10 @@ namespace PGBE
 
         std::vector<sprite_attributes> m_sprite_buffer;
         
-        int m_cur_cycle_in_scanline;
+        Scheduler& m_scheduler;
+        u64 m_line_start; // T-cycle at which the current scanline started
+        int m_cur_cycle_in_scanline; // position in the scanline while the LCD is off
+        bool m_enabled; // LCD state seen by the last check_lcd()
         int m_window_line_counter;
         int m_drawing_cycle_nb;
         bool m_frame_completed;
@@ -140,10 +155,14 @@ namespace PGBE
 
         void m_check_coincidence();
         void m_check_stat();
+        bool m_stat_condition();
 
         void m_draw_scanline();
+        bool m_window_on_line();
         void m_scan_oam();
         void m_switch_mode(state new_state);
+        void m_schedule_mode_end(u64 earliest);
+        void m_schedule_check();
 
         int m_get_tile_data(int tile_id, int x, int y);
 
@@ -0,0 +1,295 @@
+#include "RTC.h"
+#include <chrono>
+
+namespace PGBE
+{
+    constexpr u64 T_CYCLES_PER_SECOND = 4'194'304;
+    constexpr u64 MS_PER_SECOND = 1000;
+
+    static u64 read_le(std::span<const u8> p, int size)
+    {
+        u64 res = 0;
+        for (int i = size - 1; i >= 0; --i)
+        {
+            res = (res << 8) | p[i];
+        }
+
+        return res;
+    }
+
+    static void write_le(std::span<u8> p, int size, u64 v)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            p[i] = (u8)(v >> (i * 8));
+        }
+    }
+
+    static u64 unix_time_ms()
+    {
+        using namespace std::chrono;
+        return (u64)duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    RTC::RTC(rtc_clock clock, const u64& t_cycle, std::span<u8> save) :
+        m_clock(clock),
+        m_t_cycle(t_cycle),
+        m_save(save),
+        m_seconds(0),
+        m_minutes(0),
+        m_hours(0),
+        m_days(0),
+        m_halted(false),
+        m_carry(false),
+        m_reference(0),
+        m_subsecond(0),
+        m_latched()
+    {
+        m_reference = m_time();
+
+        // A new save file is all 0s
+        const u64 saved_at = m_save.empty() ? 0 : read_le(m_save.subspan(40), 8);
+        if (saved_at == 0)
+        {
+            return;
+        }
+
+        m_seconds = read_le(m_save.subspan(0), 4) & 0x3F;
+        m_minutes = read_le(m_save.subspan(4), 4) & 0x3F;
+        m_hours = read_le(m_save.subspan(8), 4) & 0x1F;
+        m_days = (u16)(read_le(m_save.subspan(12), 4) & 0xFF);
+
+        const u8 dh = (u8)read_le(m_save.subspan(16), 4);
+        m_days |= (dh & 0x01) << 8;
+        m_halted = (dh & 0x40) != 0;
+        m_carry = (dh & 0x80) != 0;
+
+        for (int i = 0; i < 5; ++i)
+        {
+            m_latched[i] = (u8)read_le(m_save.subspan(20 + i * 4), 4);
+        }
+
+        // The emulated clock doesn't run while the emulator is closed
+        if (m_clock == RTC_HOST_CLOCK)
+        {
+            m_reference = saved_at * MS_PER_SECOND;
+        }
+    }
+
+    RTC::~RTC()
+    {
+        m_store();
+    }
+
+    u8 RTC::read(int reg)
+    {
+        return m_latched[reg - 0x08];
+    }
+
+    void RTC::write(int reg, u8 v)
+    {
+        m_update();
+
+        switch (reg)
+        {
+        case 0x08:
+            // Also resets the prescaler
+            m_seconds = v & 0x3F;
+            m_subsecond = 0;
+            break;
+        case 0x09:
+            m_minutes = v & 0x3F;
+            break;
+        case 0x0A:
+            m_hours = v & 0x1F;
+            break;
+        case 0x0B:
+            m_days = (m_days & 0x100) | v;
+            break;
+        case 0x0C:
+            m_days = (m_days & 0xFF) | ((v & 0x01) << 8);
+            m_halted = (v & 0x40) != 0;
+            m_carry = (v & 0x80) != 0;
+            break;
+        }
+
+        m_store();
+    }
+
+    void RTC::latch()
+    {
+        m_update();
+
+        for (int i = 0; i < 5; ++i)
+        {
+            m_latched[i] = m_register(0x08 + i);
+        }
+
+        m_store();
+    }
+
+    void RTC::save_state(StateWriter& w)
+    {
+        w.put(m_clock);
+        w.put(m_seconds);
+        w.put(m_minutes);
+        w.put(m_hours);
+        w.put(m_days);
+        w.put(m_halted);
+        w.put(m_carry);
+        w.put(m_reference);
+        w.put(m_subsecond);
+        w.put(m_latched);
+    }
+
+    void RTC::load_state(StateReader& r)
+    {
+        const rtc_clock clock = r.get<rtc_clock>();
+        m_seconds = r.get<u8>();
+        m_minutes = r.get<u8>();
+        m_hours = r.get<u8>();
+        m_days = r.get<u16>();
+        m_halted = r.get<bool>();
+        m_carry = r.get<bool>();
+        m_reference = r.get<u64>();
+        m_subsecond = r.get<u64>();
+        m_latched = r.get<std::array<u8, 5>>();
+
+        // Saved with the other clock, the counters go on from now
+        if (clock != m_clock)
+        {
+            m_reference = m_time();
+            m_subsecond = 0;
+        }
+
+        m_store();
+    }
+
+    u64 RTC::m_time()
+    {
+        return (m_clock == RTC_HOST_CLOCK) ? unix_time_ms() : m_t_cycle;
+    }
+
+    u64 RTC::m_rate()
+    {
+        return (m_clock == RTC_HOST_CLOCK) ? MS_PER_SECOND : T_CYCLES_PER_SECOND;
+    }
+
+    void RTC::m_update()
+    {
+        const u64 t = m_time();
+
+        // The host clock was set back
+        if (t < m_reference)
+        {
+            m_reference = t;
+            return;
+        }
+
+        if (!m_halted)
+        {
+            const u64 elapsed = m_subsecond + (t - m_reference);
+            m_advance(elapsed / m_rate());
+            m_subsecond = elapsed % m_rate();
+        }
+
+        m_reference = t;
+    }
+
+    void RTC::m_advance(u64 seconds)
+    {
+        // Out of range values written by the game count up to their bit width before wrapping, without carry
+        while (seconds > 0 && (m_seconds >= 60 || m_minutes >= 60 || m_hours >= 24))
+        {
+            m_tick();
+            --seconds;
+        }
+
+        if (seconds == 0)
+        {
+            return;
+        }
+
+        u64 total = ((m_days * 24ULL + m_hours) * 60 + m_minutes) * 60 + m_seconds + seconds;
+        m_seconds = total % 60;
+        total /= 60;
+        m_minutes = total % 60;
+        total /= 60;
+        m_hours = total % 24;
+        total /= 24;
+
+        if (total >= 512)
+        {
+            m_carry = true;
+        }
+        m_days = total % 512;
+    }
+
+    void RTC::m_tick()
+    {
+        m_seconds = (m_seconds + 1) & 0x3F;
+        if (m_seconds != 60)
+        {
+            return;
+        }
+
+        m_seconds = 0;
+        m_minutes = (m_minutes + 1) & 0x3F;
+        if (m_minutes != 60)
+        {
+            return;
+        }
+
+        m_minutes = 0;
+        m_hours = (m_hours + 1) & 0x1F;
+        if (m_hours != 24)
+        {
+            return;
+        }
+
+        m_hours = 0;
+        if (++m_days == 512)
+        {
+            m_days = 0;
+            m_carry = true;
+        }
+    }
+
+    u8 RTC::m_register(int reg)
+    {
+        switch (reg)
+        {
+        case 0x08:
+            return m_seconds;
+        case 0x09:
+            return m_minutes;
+        case 0x0A:
+            return m_hours;
+        case 0x0B:
+            return (u8)(m_days & 0xFF);
+        case 0x0C:
+            return (u8)((m_days >> 8) | (m_halted << 6) | (m_carry << 7));
+        }
+
+        return 0xFF;
+    }
+
+    void RTC::m_store()
+    {
+        if (m_save.empty())
+        {
+            return;
+        }
+
+        m_update();
+
+        for (int i = 0; i < 5; ++i)
+        {
+            write_le(m_save.subspan(i * 4), 4, m_register(0x08 + i));
+            write_le(m_save.subspan(20 + i * 4), 4, m_latched[i]);
+        }
+
+        // The counters are up to date with the host clock, not only with the emulated one
+        write_le(m_save.subspan(40), 8, unix_time_ms() / MS_PER_SECOND);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+#include "integers.h"
+#include "SaveState.h"
+#include <array>
+#include <cstddef>
+#include <span>
+
+namespace PGBE
+{
+    enum rtc_clock : u8
+    {
+        RTC_HOST_CLOCK, // follows the host wall clock, also while the emulator is closed
+        RTC_EMULATED_CLOCK, // follows the emulated T-cycles, deterministic
+    };
+
+    // Saved after the cartridge RAM : S, M, H, DL, DH then the latched ones as u32,
+    // then the unix time they were taken at as u64, like other emulators do
+    constexpr std::size_t RTC_SAVE_SIZE = 48;
+
+    // MBC3 real time clock. The counters aren't ticked, they catch up with the time elapsed
+    // since the last access when latched or written.
+    class RTC
+    {
+    public:
+        // t_cycle is the emulated clock, save is empty or RTC_SAVE_SIZE bytes to keep the state in
+        RTC(rtc_clock clock, const u64& t_cycle, std::span<u8> save);
+        ~RTC();
+
+        RTC(const RTC&) = delete;
+        RTC& operator=(const RTC&) = delete;
+
+        // reg is the RAM bank number selecting it, 0x08-0x0C
+        u8 read(int reg);
+        void write(int reg, u8 v);
+        // Copies the counters to the registers read
+        void latch();
+
+        void save_state(StateWriter& w);
+        void load_state(StateReader& r);
+    private:
+        u64 m_time();
+        u64 m_rate();
+        void m_update();
+        void m_advance(u64 seconds);
+        void m_tick();
+        // 0x08-0x0C register value from the counters
+        u8 m_register(int reg);
+        void m_store();
+
+        rtc_clock m_clock;
+        const u64& m_t_cycle;
+        std::span<u8> m_save;
+
+        u8 m_seconds;
+        u8 m_minutes;
+        u8 m_hours;
+        u16 m_days;
+        bool m_halted;
+        bool m_carry;
+
+        // m_time() the counters were last updated at, the fraction of second left since then
+        u64 m_reference;
+        u64 m_subsecond;
+
+        std::array<u8, 5> m_latched; // S, M, H, DL, DH
+    };
+}
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include "Rewind.h"
+#include <cstring>
+#include <utility>
+
+namespace PGBE
+{
+    // Equal bytes a literal run stops at, shorter ones cost less to keep in it
+    constexpr std::size_t MIN_ZERO_RUN = 4;
+
+    static u8* put_varint(u8* p, std::size_t v)
+    {
+        while (v >= 0x80)
+        {
+            *p++ = (u8)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (u8)v;
+
+        return p;
+    }
+
+    static std::size_t get_varint(const u8*& p)
+    {
+        std::size_t v = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            const u8 b = *p++;
+            v |= (std::size_t)(b & 0x7F) << shift;
+            if ((b & 0x80) == 0)
+            {
+                return v;
+            }
+        }
+    }
+
+    // a XOR b as (number of 0s, number of literals, literals) triplets, returns the size written.
+    // out holds at least 3 * a.size() + 16 bytes.
+    static std::size_t encode_delta(std::span<const u8> a, std::span<const u8> b, u8* out)
+    {
+        const std::size_t n = a.size();
+        u8* p = out;
+        std::size_t i = 0;
+
+        while (i < n)
+        {
+            // Equal stretches are skipped 8 bytes at a time
+            const std::size_t zeros = i;
+            for (u64 x, y; i + 8 <= n; i += 8)
+            {
+                std::memcpy(&x, a.data() + i, 8);
+                std::memcpy(&y, b.data() + i, 8);
+                if (x != y)
+                {
+                    break;
+                }
+            }
+            while (i < n && a[i] == b[i])
+            {
+                ++i;
+            }
+
+            const std::size_t literals = i;
+            while (i < n)
+            {
+                if (i + MIN_ZERO_RUN <= n && std::memcmp(a.data() + i, b.data() + i, MIN_ZERO_RUN) == 0)
+                {
+                    break;
+                }
+                ++i;
+            }
+
+            p = put_varint(p, literals - zeros);
+            p = put_varint(p, i - literals);
+            for (std::size_t k = literals; k < i; ++k)
+            {
+                *p++ = a[k] ^ b[k];
+            }
+        }
+
+        return p - out;
+    }
+
+    // XORs back what encode_delta() wrote into state
+    static void apply_delta(std::span<const u8> delta, std::span<u8> state)
+    {
+        const u8* p = delta.data();
+        const u8* end = p + delta.size();
+        std::size_t i = 0;
+
+        while (p < end)
+        {
+            i += get_varint(p);
+            const std::size_t literals = get_varint(p);
+            for (std::size_t k = 0; k < literals; ++k)
+            {
+                state[i++] ^= *p++;
+            }
+        }
+    }
+
+    Rewind::Rewind(GameBoy* gb, std::size_t buffer_size, int interval) :
+        m_gb(gb),
+        m_interval(interval),
+        m_frames(0),
+        m_has_current(false),
+        m_current(),
+        m_next(),
+        m_delta(),
+        m_buffer(buffer_size),
+        m_snapshots(),
+        m_head(0),
+        m_used(0)
+    {
+    }
+
+    void Rewind::frame_completed()
+    {
+        if (++m_frames < m_interval)
+        {
+            return;
+        }
+        m_frames = 0;
+
+        // The state size only changes with the cartridge
+        const std::size_t size = m_gb->state_size();
+        if (size != m_current.size())
+        {
+            clear();
+            m_current.resize(size);
+            m_next.resize(size);
+            m_delta.resize(3 * size + 16);
+        }
+
+        // The framebuffer is drawn again when stepping back, it would only bloat the deltas
+        if (!m_has_current)
+        {
+            m_gb->save_state(m_current, false);
+            m_has_current = true;
+            return;
+        }
+
+        m_gb->save_state(m_next, false);
+        m_push({ m_delta.data(), encode_delta(m_current, m_next, m_delta.data()) });
+        std::swap(m_current, m_next);
+    }
+
+    bool Rewind::step_back()
+    {
+        if (!m_has_current)
+        {
+            return false;
+        }
+
+        // Already on the last state taken, go to the one before
+        if (m_frames <= 1)
+        {
+            if (m_snapshots.empty())
+            {
+                return false;
+            }
+
+            const snapshot s = m_snapshots.back();
+            m_snapshots.pop_back();
+            apply_delta({ m_buffer.data() + s.offset, s.size }, m_current);
+            m_head = s.offset;
+            m_used -= s.size;
+        }
+
+        m_gb->load_state(m_current);
+        m_gb->run_frame();
+        m_frames = 1;
+
+        return true;
+    }
+
+    void Rewind::clear()
+    {
+        m_snapshots.clear();
+        m_has_current = false;
+        m_frames = 0;
+        m_head = 0;
+        m_used = 0;
+    }
+
+    std::size_t Rewind::size() const
+    {
+        return m_has_current ? m_snapshots.size() + 1 : 0;
+    }
+
+    double Rewind::seconds() const
+    {
+        return (double)(size() * m_interval) / 60;
+    }
+
+    std::size_t Rewind::used() const
+    {
+        return m_used;
+    }
+
+    void Rewind::m_push(std::span<const u8> delta)
+    {
+        if (delta.size() > m_buffer.size())
+        {
+            // The states before can't be rebuilt without it
+            m_snapshots.clear();
+            m_head = 0;
+            m_used = 0;
+            return;
+        }
+
+        if (m_head + delta.size() > m_buffer.size())
+        {
+            // The deltas left past m_head are the oldest ones, older than those the wrap overwrites
+            while (!m_snapshots.empty() && m_snapshots.front().offset >= m_head)
+            {
+                m_used -= m_snapshots.front().size;
+                m_snapshots.pop_front();
+            }
+            m_head = 0;
+        }
+
+        // Drops the oldest deltas in the way, they are the next ones from m_head on
+        while (!m_snapshots.empty())
+        {
+            const snapshot& oldest = m_snapshots.front();
+            if (oldest.offset >= m_head + delta.size() || oldest.offset + oldest.size <= m_head)
+            {
+                break;
+            }
+
+            m_used -= oldest.size;
+            m_snapshots.pop_front();
+        }
+
+        std::memcpy(m_buffer.data() + m_head, delta.data(), delta.size());
+        m_snapshots.push_back(snapshot{ .offset = m_head, .size = delta.size() });
+        m_head += delta.size();
+        m_used += delta.size();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+#include "GameBoy.h"
+#include "integers.h"
+#include <cstddef>
+#include <deque>
+#include <span>
+#include <vector>
+
+namespace PGBE
+{
+    // History of the machine states to step back through. A state is taken every few frames and
+    // the one before it is only kept as the XOR of both, its runs of 0s squeezed out : between two
+    // frames most of the machine didn't change. The oldest states are dropped when the buffer is full.
+    class Rewind
+    {
+    public:
+        // Keeps a state every interval frames in buffer_size bytes
+        Rewind(GameBoy* gb, std::size_t buffer_size, int interval);
+
+        // To call after every frame run
+        void frame_completed();
+        // Goes back to the previous state kept and runs a frame from it to draw the screen.
+        // False once the history is exhausted, the machine is then left where it was.
+        bool step_back();
+        // Forgets the history, when another rom is loaded
+        void clear();
+
+        // States kept, about seconds() of play
+        std::size_t size() const;
+        double seconds() const;
+        // Bytes used in the buffer
+        std::size_t used() const;
+    private:
+        struct snapshot
+        {
+            std::size_t offset;
+            std::size_t size;
+        };
+
+        void m_push(std::span<const u8> delta);
+
+        GameBoy* m_gb;
+        int m_interval;
+        int m_frames; // run since m_current was taken
+        bool m_has_current;
+
+        // The last state taken, the previous ones are rebuilt from it
+        std::vector<u8> m_current;
+        std::vector<u8> m_next;
+        std::vector<u8> m_delta;
+
+        // Ring of compressed deltas, from the oldest to the newest
+        std::vector<u8> m_buffer;
+        std::deque<snapshot> m_snapshots;
+        std::size_t m_head; // where the next delta goes
+        std::size_t m_used;
+    };
+}
\ No newline at end of file
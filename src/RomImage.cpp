@@ -0,0 +1,142 @@
+#include "RomImage.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace PGBE
+{
+    constexpr std::size_t BANK_SIZE = 0x4000;
+    constexpr std::size_t HEADER_END = 0x150;
+
+    // Whole banks, at least 2
+    static std::size_t padded_size(std::size_t size)
+    {
+        return std::max(2 * BANK_SIZE, (size + BANK_SIZE - 1) / BANK_SIZE * BANK_SIZE);
+    }
+
+    RomImage::RomImage() :
+        m_data(nullptr),
+        m_size(0),
+        m_mapping(nullptr),
+        m_copy()
+    {
+    }
+
+    RomImage::~RomImage()
+    {
+#if !defined(_WIN32)
+        if (m_mapping != nullptr)
+        {
+            munmap(m_mapping, m_size);
+        }
+#endif
+    }
+
+    std::shared_ptr<const RomImage> RomImage::open(std::string_view path)
+    {
+        std::error_code ec;
+        const auto canonical = std::filesystem::canonical(std::filesystem::path{path}, ec);
+        const auto size = ec ? 0 : std::filesystem::file_size(canonical, ec);
+        const auto time = ec ? std::filesystem::file_time_type{} : std::filesystem::last_write_time(canonical, ec);
+
+        if (ec)
+        {
+            fmt::print("Can't open rom file {}...\n", path);
+            return nullptr;
+        }
+
+        if (size < HEADER_END)
+        {
+            fmt::print("{} is too short to be a rom ({} bytes)...\n", path, size);
+            return nullptr;
+        }
+
+        // A rebuilt rom doesn't share the image of its previous version
+        const std::string key = fmt::format("{}:{}:{}", canonical.string(), size, time.time_since_epoch().count());
+
+        static std::mutex mutex;
+        static std::map<std::string, std::weak_ptr<const RomImage>> images;
+
+        std::lock_guard lock(mutex);
+
+        if (auto image = images[key].lock())
+        {
+            return image;
+        }
+
+        std::shared_ptr<RomImage> image(new RomImage());
+
+#if !defined(_WIN32)
+        if (size >= 2 * BANK_SIZE && size % BANK_SIZE == 0)
+        {
+            int fd = ::open(canonical.c_str(), O_RDONLY);
+            if (fd >= 0)
+            {
+                void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+
+                if (p != MAP_FAILED)
+                {
+                    image->m_mapping = p;
+                    image->m_data = static_cast<const u8*>(p);
+                    image->m_size = size;
+                }
+            }
+        }
+#endif
+
+        if (image->m_data == nullptr)
+        {
+            std::ifstream input(canonical, std::ios::binary);
+            image->m_copy.resize(padded_size(size), 0xFF);
+
+            if (!input.read(reinterpret_cast<char*>(image->m_copy.data()), size))
+            {
+                fmt::print("Can't read rom file {}...\n", path);
+                return nullptr;
+            }
+
+            image->m_data = image->m_copy.data();
+            image->m_size = image->m_copy.size();
+        }
+
+        images[key] = image;
+
+        // Drop the entries of the roms nobody runs anymore
+        std::erase_if(images, [](const auto& entry) { return entry.second.expired(); });
+
+        return image;
+    }
+
+    std::shared_ptr<const RomImage> RomImage::copy(std::span<const u8> rom)
+    {
+        if (rom.size() < HEADER_END)
+        {
+            fmt::print("The rom is too short ({} bytes)...\n", rom.size());
+            return nullptr;
+        }
+
+        std::shared_ptr<RomImage> image(new RomImage());
+        image->m_copy.resize(padded_size(rom.size()), 0xFF);
+        std::copy(rom.begin(), rom.end(), image->m_copy.begin());
+
+        image->m_data = image->m_copy.data();
+        image->m_size = image->m_copy.size();
+
+        return image;
+    }
+
+    std::span<const u8> RomImage::data() const
+    {
+        return { m_data, m_size };
+    }
+}
\ No newline at end of file
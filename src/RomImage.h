@@ -0,0 +1,38 @@
+#pragma once
+#include "integers.h"
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PGBE
+{
+    // Read-only cartridge rom, mapped from the file and shared by every emulator instance running it
+    class RomImage
+    {
+    public:
+        ~RomImage();
+
+        RomImage(const RomImage&) = delete;
+        RomImage& operator=(const RomImage&) = delete;
+
+        // Returns the image already open for that file if there is one,
+        // nullptr when the file can't be read or is too short for a cartridge header
+        static std::shared_ptr<const RomImage> open(std::string_view path);
+        // Copy of a rom already in memory, not shared, nullptr when too short for a cartridge header
+        static std::shared_ptr<const RomImage> copy(std::span<const u8> rom);
+
+        // Whole 16 KB banks, at least 2
+        std::span<const u8> data() const;
+    private:
+        RomImage();
+
+        const u8* m_data;
+        std::size_t m_size;
+        void* m_mapping;
+        // Roms that aren't made of whole banks are copied and padded instead
+        std::vector<u8> m_copy;
+    };
+}
\ No newline at end of file
@@ -1,65 +1,44 @@
 #include "SM83.h"
 #include "utils.h"
+#include <algorithm>
+#include <cstddef>
 #include <fmt/core.h>
-#include <functional>
 #include <stdexcept>
 
 namespace PGBE
 {
-    template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
-
-    SM83::SM83(MMU* mmu, Timer* t) :
-        m_registers(),
-        m_ime(false),
-        m_halted(false),
-        m_halt_bug(false),
-        m_mmu(mmu),
-        m_timer(t),
-        m_IF(mmu->io_reg->at(IF)),
-        m_IE(mmu->ie_reg)
-    {}
-
-    void SM83::run()
+    constexpr std::array<reg_s, 8> r_table
     {
-        if (m_halt_bug)
-        {
-            m_halt_bug = false;
-            m_registers.PC--;
-        }
-
-        if (m_halted)
-        {
-            m_advance_cycle();
-            if ((m_IF & m_IE & 0x1F) != 0)
-            {
-                m_halted = false;
-                m_advance_cycle();
-            }
-            else
-            {
-                return;
-            }
-        }
-
-        m_isr();
-
-        auto opcode = m_fetch();
-        auto instr = m_decode(opcode);
-        m_execute(instr);
-
-        m_prev_op = instr;
-    }
-
-    void SM83::reset()
+        reg_s{ B, false },
+        reg_s{ C, false },
+        reg_s{ D, false },
+        reg_s{ E, false },
+        reg_s{ H, false },
+        reg_s{ L, false },
+        reg_s{ HL, true },
+        reg_s{ A, false },
+    };
+
+    constexpr std::array<reg_s, 4> rp_table
     {
-        m_registers.reset();
-        m_ime = false;
-        m_halted = false;
-        m_halt_bug = false;
-    }
+        reg_s{ BC, false },
+        reg_s{ DE, false },
+        reg_s{ HL, false },
+        reg_s{ SP, false },
+    };
 
-    OP SM83::m_decode(u8 opcode)
+    constexpr std::array<reg_s, 4> rp2_table
     {
+        reg_s{ BC, false },
+        reg_s{ DE, false },
+        reg_s{ HL, false },
+        reg_s{ AF, false },
+    };
+
+    // Decodes a table index : 0x000-0x0FF are the base opcodes, 0x100-0x1FF the CB-prefixed ones
+    constexpr OP decode(u16 index)
+    {
+        u8 opcode = index & 0xFF;
         u8 x = (opcode & 0xC0) >> 6,
             y = (opcode & 0x38) >> 3,
             z = (opcode & 0x07),
@@ -71,16 +50,9 @@ namespace PGBE
             .y = y
         };
 
-        if (opcode == 0xCB)
+        if (index > 0xFF)
         {
-            opcode = m_fetch();
-
-            x = (opcode & 0xC0) >> 6;
-            y = (opcode & 0x38) >> 3;
-            z = (opcode & 0x07);
-
-            res.y = y;
-            res.args[0] = m_r.at(z);
+            res.args[0] = r_table.at(z);
 
             switch (x)
             {
@@ -150,13 +122,13 @@ namespace PGBE
                         // ADD HL, rp[p]
                         res.name = OP::ADD_16;
                         res.args[0] = { HL, false };
-                        res.args[1] = m_rp.at(p);
+                        res.args[1] = rp_table.at(p);
                     }
                     else
                     {
                         // LD rp[p], nn
                         res.name = OP::LD;
-                        res.args[0] = m_rp.at(p);
+                        res.args[0] = rp_table.at(p);
                         res.args[1] = { nn, false };
                     }
                     break;
@@ -215,25 +187,25 @@ namespace PGBE
                     // INC rp[p]
                     // DEC rp[p]
                     res.name = q ? OP::DEC_16 : OP::INC_16;
-                    res.args[0] = m_rp.at(p);
+                    res.args[0] = rp_table.at(p);
                     break;
                 case 4:
                     // 8-bit INC
                     // INC r[y]
                     res.name = OP::INC;
-                    res.args[0] = m_r.at(y);
+                    res.args[0] = r_table.at(y);
                     break;
                 case 5:
                     // 8-bit DEC
                     // DEC r[y]
                     res.name = OP::DEC;
-                    res.args[0] = m_r.at(y);
+                    res.args[0] = r_table.at(y);
                     break;
                 case 6:
                     // 8-bit load immediate
                     // LD r[y], n
                     res.name = OP::LD;
-                    res.args[0] = m_r.at(y);
+                    res.args[0] = r_table.at(y);
                     res.args[1] = { n, false };
                     break;
                 case 7:
@@ -283,15 +255,15 @@ namespace PGBE
                     // 8-bit loading
                     // LD r[y], r[z]
                     res.name = OP::LD;
-                    res.args[0] = m_r.at(y);
-                    res.args[1] = m_r.at(z);
+                    res.args[0] = r_table.at(y);
+                    res.args[1] = r_table.at(z);
                 }
                 break;
             case 2:
                 // Operate on accumulator and register/memory location
                 // alu[y] r[z]
                 res.name = OP::ALU;
-                res.args[0] = m_r.at(z);
+                res.args[0] = r_table.at(z);
                 break;
             case 3:
                 switch (z)
@@ -363,7 +335,7 @@ namespace PGBE
                     {
                         // POP rp2[p]
                         res.name = OP::POP;
-                        res.args[0] = m_rp2.at(p);
+                        res.args[0] = rp2_table.at(p);
                     }
                     break;
                 case 2:
@@ -441,7 +413,7 @@ namespace PGBE
                     else
                     {
                         res.name = OP::PUSH;
-                        res.args[0] = m_rp2.at(p);
+                        res.args[0] = rp2_table.at(p);
                     }
                     break;
                 case 6:
@@ -459,175 +431,1263 @@ namespace PGBE
         return res;
     }
 
-    void SM83::m_execute(OP instr)
+    // 256 base opcodes followed by the 256 CB-prefixed ones, decoded at compile time
+    constexpr auto decode_table = []()
     {
-        if (instr.name == OP::INVALID)
+        std::array<OP, 512> res{};
+
+        for (u16 i = 0; i < res.size(); ++i)
         {
-            exit(666);
+            res[i] = decode(i);
         }
 
-        u8 y = instr.y;
-        auto arg1 = instr.args[0];
-        auto arg2 = instr.args[1];
+        return res;
+    }();
+
+    // Size in bytes of every decode table entry, opcode and immediate operands included
+    constexpr auto length_table = []()
+    {
+        std::array<u8, 512> res{};
 
-        switch (instr.name)
+        for (u16 i = 0; i < res.size(); ++i)
         {
-        case OP::ALU:
-            m_alu.at(y)(std::get<u8>(m_get_reg(arg1)));
-            break;
-        case OP::ADD_16:
-            m_add_16(arg1, arg2);
-            break;
-        case OP::BIT:
-            m_bit(std::get<u8>(m_get_reg(arg1)), y);
-            break;
-        case OP::RES:
+            const OP& op = decode_table[i];
+
+            if (i > 0xFF)
+            {
+                res[i] = 2;
+                continue;
+            }
+
+            res[i] = 1;
+            for (const auto& arg : op.args)
+            {
+                if (arg.name == n || arg.name == SP_d)
+                {
+                    res[i] += 1;
+                }
+                else if (arg.name == nn)
+                {
+                    res[i] += 2;
+                }
+            }
+
+            if (op.name == OP::JR || op.name == OP::JR_CC
+                || (op.name == OP::ADD_16 && op.args[0].name == SP))
+            {
+                res[i] += 1;
+            }
+            else if (op.name == OP::CALL || op.name == OP::CALL_CC)
+            {
+                res[i] += 2;
+            }
+        }
+
+        return res;
+    }();
+
+    // Instructions after which the next PC isn't known at decode time
+    constexpr bool ends_block(u16 index)
+    {
+        switch (decode_table[index].name)
+        {
+        case OP::CALL:
+        case OP::CALL_CC:
+        case OP::HALT:
+        case OP::INVALID:
+        case OP::JP:
+        case OP::JP_CC:
+        case OP::JP_HL:
+        case OP::JR:
+        case OP::JR_CC:
+        case OP::RET:
+        case OP::RET_CC:
+        case OP::RETI:
+        case OP::RST:
+        case OP::STOP:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    constexpr std::size_t MAX_BLOCK_SIZE = 64; // instructions
+
+    SM83::SM83(MMU* mmu, Timer* t, PPU* ppu) :
+        m_registers(),
+        m_ime(false),
+        m_halted(false),
+        m_halt_bug(false),
+        m_mmu(mmu),
+        m_timer(t),
+        m_ppu(ppu),
+        m_cycle_counter(0),
+        m_instr_counter(0),
+        m_deadline(0),
+        m_IF(mmu->io_reg.at(IF)),
+        m_IE(mmu->ie_reg),
+        m_ei_delay(false),
+        m_block(nullptr),
+        m_block_index(0),
+        m_prefetch(nullptr),
+        m_idle_block(nullptr),
+        m_idle_start(0),
+        m_idle_quiet(0),
+        m_code_changed(false)
+#if defined(PGBE_DYNAREC)
+        , m_dynarec_enabled(m_dynarec.available())
+        , m_jit_retired(0)
+#endif
+    {
+        m_code_pages.fill(false);
+    }
+
+    void SM83::run()
+    {
+        if (!m_handle_halt())
+        {
+            return;
+        }
+
+        m_isr();
+
+#if defined(PGBE_DYNAREC)
+        if (m_run_translated())
+        {
+            return;
+        }
+#endif
+
+        (this->*m_handlers[m_fetch_opcode()])();
+    }
+
+#if defined(PGBE_THREADED_INTERPRETER) && (defined(__GNUC__) || defined(__clang__))
+#define PGBE_COMPUTED_GOTO
+#endif
+
+    // X(p, h, l) is expanded for every decode table index 0xphl
+#define PGBE_OPCODE_ROW(X, p, h) \
+    X(p, h, 0) X(p, h, 1) X(p, h, 2) X(p, h, 3) X(p, h, 4) X(p, h, 5) X(p, h, 6) X(p, h, 7) \
+    X(p, h, 8) X(p, h, 9) X(p, h, A) X(p, h, B) X(p, h, C) X(p, h, D) X(p, h, E) X(p, h, F)
+#define PGBE_OPCODE_PAGE(X, p) \
+    PGBE_OPCODE_ROW(X, p, 0) PGBE_OPCODE_ROW(X, p, 1) PGBE_OPCODE_ROW(X, p, 2) PGBE_OPCODE_ROW(X, p, 3) \
+    PGBE_OPCODE_ROW(X, p, 4) PGBE_OPCODE_ROW(X, p, 5) PGBE_OPCODE_ROW(X, p, 6) PGBE_OPCODE_ROW(X, p, 7) \
+    PGBE_OPCODE_ROW(X, p, 8) PGBE_OPCODE_ROW(X, p, 9) PGBE_OPCODE_ROW(X, p, A) PGBE_OPCODE_ROW(X, p, B) \
+    PGBE_OPCODE_ROW(X, p, C) PGBE_OPCODE_ROW(X, p, D) PGBE_OPCODE_ROW(X, p, E) PGBE_OPCODE_ROW(X, p, F)
+#define PGBE_FOR_EACH_OPCODE(X) PGBE_OPCODE_PAGE(X, 0) PGBE_OPCODE_PAGE(X, 1)
+
+    void SM83::run_for(u64 budget)
+    {
+        m_deadline = m_cycle_counter + budget;
+        m_run_until(m_deadline);
+        m_deadline = 0;
+    }
+
+    void SM83::m_run_until(u64 target)
+    {
+#if defined(PGBE_DYNAREC)
+        // Translated blocks run until the budget is consumed, plain run() only single steps them
+        while (m_cycle_counter < target && !m_ppu->frame_completed())
+        {
+            run();
+        }
+#elif defined(PGBE_COMPUTED_GOTO)
+        // Threaded code : every handler ends with its own copy of the dispatch
+#define PGBE_LABEL_ADDRESS(p, h, l) &&op_##p##h##l,
+#define PGBE_DISPATCH() \
+        if (m_cycle_counter >= target || m_ppu->frame_completed()) return; \
+        if (m_halted || m_halt_bug) goto halted; \
+        m_isr(); \
+        goto *labels[m_fetch_opcode()]
+#define PGBE_HANDLER(p, h, l) op_##p##h##l: m_execute<decode_table[0x##p##h##l]>(); PGBE_DISPATCH();
+
+        static void* const labels[512] = { PGBE_FOR_EACH_OPCODE(PGBE_LABEL_ADDRESS) };
+
+        PGBE_DISPATCH();
+    halted:
+        m_handle_halt();
+        PGBE_DISPATCH();
+
+        PGBE_FOR_EACH_OPCODE(PGBE_HANDLER)
+
+#undef PGBE_HANDLER
+#undef PGBE_DISPATCH
+#undef PGBE_LABEL_ADDRESS
+#elif defined(PGBE_THREADED_INTERPRETER)
+#define PGBE_CASE(p, h, l) case 0x##p##h##l: m_execute<decode_table[0x##p##h##l]>(); break;
+
+        while (m_cycle_counter < target && !m_ppu->frame_completed())
+        {
+            if (!m_handle_halt())
+            {
+                continue;
+            }
+
+            m_isr();
+
+            switch (m_fetch_opcode())
+            {
+                PGBE_FOR_EACH_OPCODE(PGBE_CASE)
+            }
+        }
+
+#undef PGBE_CASE
+#else
+        while (m_cycle_counter < target && !m_ppu->frame_completed())
+        {
+            run();
+        }
+#endif
+    }
+
+#undef PGBE_FOR_EACH_OPCODE
+#undef PGBE_OPCODE_PAGE
+#undef PGBE_OPCODE_ROW
+
+    bool SM83::m_handle_halt()
+    {
+        if (m_halt_bug)
+        {
+            m_halt_bug = false;
+            m_registers.PC--;
+        }
+
+        if (m_halted)
+        {
+            m_advance_cycle();
+            if ((m_IF & m_IE & 0x1F) != 0)
+            {
+                m_halted = false;
+                m_advance_cycle();
+            }
+            else
+            {
+                // Nothing can wake the CPU up before the next event
+                m_skip(m_idle_cycles());
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    u64 SM83::cycles()
+    {
+        return m_cycle_counter;
+    }
+
+    u64 SM83::instructions()
+    {
+        return m_instr_counter;
+    }
+
+    u64 SM83::m_idle_cycles()
+    {
+        // A completed frame hands control back to the frontend first
+        if (m_cycle_counter >= m_deadline || m_ppu->frame_completed())
+        {
+            return 0;
+        }
+
+        return std::min(m_timer->idle_cycles(), m_deadline - m_cycle_counter);
+    }
+
+    void SM83::m_skip(u64 m_cycles)
+    {
+        m_cycle_counter += m_cycles;
+        m_timer->skip(m_cycles);
+    }
+
+    void SM83::reset()
+    {
+        m_registers.reset();
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy.op = LAZY_NONE;
+#endif
+        m_ime = false;
+        m_halted = false;
+        m_halt_bug = false;
+        m_ei_delay = false;
+
+        m_rom_blocks.clear();
+        m_ram_blocks.clear();
+        m_code_pages.fill(false);
+        m_block = nullptr;
+        m_prefetch = nullptr;
+        m_idle_block = nullptr;
+        m_code_changed = false;
+
+#if defined(PGBE_DYNAREC)
+        m_dynarec.clear();
+#endif
+    }
+
+    void SM83::skip_boot()
+    {
+        reset();
+
+        m_registers.AF = 0x01B0;
+        m_registers.BC = 0x0013;
+        m_registers.DE = 0x00D8;
+        m_registers.HL = 0x014D;
+        m_registers.SP = 0xFFFE;
+        m_registers.PC = 0x0100;
+    }
+
+    void SM83::save_state(StateWriter& w)
+    {
+        m_sync_flags();
+
+        w.put(m_cycle_counter);
+        w.put(m_registers.AF);
+        w.put(m_registers.BC);
+        w.put(m_registers.DE);
+        w.put(m_registers.HL);
+        w.put(m_registers.SP);
+        w.put(m_registers.PC);
+        w.put(m_ime);
+        w.put(m_halted);
+        w.put(m_halt_bug);
+        w.put(m_ei_delay);
+    }
+
+    void SM83::load_state(StateReader& r)
+    {
+        m_cycle_counter = r.get<u64>();
+        m_registers.AF = r.get<u16>();
+        m_registers.BC = r.get<u16>();
+        m_registers.DE = r.get<u16>();
+        m_registers.HL = r.get<u16>();
+        m_registers.SP = r.get<u16>();
+        m_registers.PC = r.get<u16>();
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy.op = LAZY_NONE;
+#endif
+        m_ime = r.get<bool>();
+        m_halted = r.get<bool>();
+        m_halt_bug = r.get<bool>();
+        m_ei_delay = r.get<bool>();
+
+        // RAM holds other code now, ROM blocks are keyed by bank and stay valid
+        m_ram_blocks.clear();
+        m_code_pages.fill(false);
+        m_block = nullptr;
+        m_prefetch = nullptr;
+        m_idle_block = nullptr;
+        m_code_changed = false;
+    }
+
+    template<std::size_t... I>
+    constexpr std::array<SM83::handler, 512> SM83::m_make_handlers(std::index_sequence<I...>)
+    {
+        return { &SM83::m_execute<decode_table[I]>... };
+    }
+
+    const std::array<SM83::handler, 512> SM83::m_handlers = SM83::m_make_handlers(std::make_index_sequence<512>{});
+
+    constexpr bool is_16_bit(reg_s r)
+    {
+        switch (r.name)
+        {
+        case AF:
+        case BC:
+        case DE:
+        case HL:
+        case SP:
+        case SP_d:
+        case nn:
+            return !r.indirect;
+        default:
+            return false;
+        }
+    }
+
+    template<OP instr>
+    void SM83::m_execute()
+    {
+        constexpr u8 y = instr.y;
+        constexpr auto arg1 = instr.args[0];
+        constexpr auto arg2 = instr.args[1];
+
+        if constexpr (instr.name == OP::INVALID)
+        {
+            exit(666);
+        }
+        else if constexpr (instr.name == OP::ALU)
         {
-            u8 tmp = std::get<u8>(m_get_reg(arg1));
+            (this->*m_alu[y])(m_get_8<arg1>());
+        }
+        else if constexpr (instr.name == OP::ADD_16)
+        {
+            m_add_16<arg1, arg2>();
+        }
+        else if constexpr (instr.name == OP::BIT)
+        {
+            m_bit(m_get_8<arg1>(), y);
+        }
+        else if constexpr (instr.name == OP::RES)
+        {
+            u8 tmp = m_get_8<arg1>();
             m_res(tmp, y);
-            m_set_reg(arg1, tmp);
+            m_set_8<arg1>(tmp);
         }
-        break;
-        case OP::SET:
+        else if constexpr (instr.name == OP::SET)
         {
-            u8 tmp = std::get<u8>(m_get_reg(arg1));
+            u8 tmp = m_get_8<arg1>();
             m_set(tmp, y);
-            m_set_reg(arg1, tmp);
+            m_set_8<arg1>(tmp);
         }
-        break;
-        case OP::NOP:
-            break;
-        case OP::CALL:
+        else if constexpr (instr.name == OP::CALL)
+        {
             m_call(m_fetch_word());
-            break;
-        case OP::CALL_CC:
-            m_call(m_fetch_word(), m_cc.at(y));
-            break;
-        case OP::DAA:
+        }
+        else if constexpr (instr.name == OP::CALL_CC)
+        {
+            m_call<y>(m_fetch_word());
+        }
+        else if constexpr (instr.name == OP::DAA)
+        {
             m_daa();
-            break;
-        case OP::CPL:
+        }
+        else if constexpr (instr.name == OP::CPL)
+        {
             m_cpl();
-            break;
-        case OP::SCF:
+        }
+        else if constexpr (instr.name == OP::SCF)
+        {
             m_scf();
-            break;
-        case OP::CCF:
+        }
+        else if constexpr (instr.name == OP::CCF)
+        {
             m_ccf();
-            break;
-        case OP::ROT:
+        }
+        else if constexpr (instr.name == OP::ROT)
         {
-            u8 tmp = std::get<u8>(m_get_reg(arg1));
-            m_rot.at(y)(tmp);
-            m_set_reg(arg1, tmp);
+            u8 tmp = m_get_8<arg1>();
+            (this->*m_rot[y])(tmp);
+            m_set_8<arg1>(tmp);
         }
-        break;
-        case OP::DEC:
+        else if constexpr (instr.name == OP::DEC)
         {
-            u8 tmp = std::get<u8>(m_get_reg(arg1));
-            m_dec(&tmp);
-            m_set_reg(arg1, tmp);
+            u8 tmp = m_get_8<arg1>();
+            m_dec(tmp);
+            m_set_8<arg1>(tmp);
         }
-        break;
-        case OP::DEC_16:
+        else if constexpr (instr.name == OP::DEC_16)
         {
-            u16 tmp = std::get<u16>(m_get_reg(arg1));
-            m_dec(&tmp);
-            m_set_reg(arg1, tmp);
+            m_dec(m_reg_16<arg1.name>());
         }
-        break;
-        case OP::INC:
+        else if constexpr (instr.name == OP::INC)
         {
-            u8 tmp = std::get<u8>(m_get_reg(arg1));
-            m_inc(&tmp);
-            m_set_reg(arg1, tmp);
+            u8 tmp = m_get_8<arg1>();
+            m_inc(tmp);
+            m_set_8<arg1>(tmp);
         }
-        break;
-        case OP::INC_16:
+        else if constexpr (instr.name == OP::INC_16)
         {
-            u16 tmp = std::get<u16>(m_get_reg(arg1));
-            m_inc(&tmp);
-            m_set_reg(arg1, tmp);
+            m_inc(m_reg_16<arg1.name>());
         }
-        break;
-        case OP::DI:
+        else if constexpr (instr.name == OP::DI)
+        {
             m_ime = false;
-            break;
-        case OP::EI:
-            break;
-        case OP::HALT:
+        }
+        else if constexpr (instr.name == OP::EI)
+        {
+            m_ei_delay = true;
+        }
+        else if constexpr (instr.name == OP::HALT)
+        {
             m_halt();
-            break;
-        case OP::JP:
+        }
+        else if constexpr (instr.name == OP::JP)
+        {
             m_jp();
-            break;
-        case OP::JP_CC:
-            m_jp(m_cc.at(y));
-            break;
-        case OP::JP_HL:
+        }
+        else if constexpr (instr.name == OP::JP_CC)
+        {
+            m_jp<y>();
+        }
+        else if constexpr (instr.name == OP::JP_HL)
+        {
             m_registers.PC = m_registers.HL;
-            break;
-        case OP::JR:
+        }
+        else if constexpr (instr.name == OP::JR)
+        {
             m_jr();
-            break;
-        case OP::JR_CC:
-            m_jr(m_cc.at(y - 4));
-            break;
-        case OP::LD:
-            m_ld(arg1, arg2);
-            break;
-        case OP::POP:
+        }
+        else if constexpr (instr.name == OP::JR_CC)
+        {
+            m_jr<y - 4>();
+        }
+        else if constexpr (instr.name == OP::LD)
+        {
+            m_ld<arg1, arg2>();
+        }
+        else if constexpr (instr.name == OP::POP)
         {
-            u16 tmp = std::get<u16>(m_get_reg(arg1));
-            m_pop(tmp);
-            m_set_reg(arg1, tmp);
+            m_pop(m_reg_16<arg1.name>());
 
-            if (arg1.name == AF)
+            if constexpr (arg1.name == AF)
             {
                 m_registers.F &= 0xF0;
             }
         }
-        break;
-        case OP::PUSH:
-            m_push(std::get<u16>(m_get_reg(arg1)));
-            break;
-        case OP::RET:
+        else if constexpr (instr.name == OP::PUSH)
+        {
+            m_push(m_reg_16<arg1.name>());
+        }
+        else if constexpr (instr.name == OP::RET)
+        {
             m_ret();
-            break;
-        case OP::RET_CC:
-            m_ret(m_cc.at(y));
-            break;
-        case OP::RETI:
+        }
+        else if constexpr (instr.name == OP::RET_CC)
+        {
+            m_ret<y>();
+        }
+        else if constexpr (instr.name == OP::RETI)
+        {
             m_reti();
-            break;
-        case OP::RLA:
+        }
+        else if constexpr (instr.name == OP::RLA)
+        {
             m_rla();
-            break;
-        case OP::RLCA:
+        }
+        else if constexpr (instr.name == OP::RLCA)
+        {
             m_rlca();
-            break;
-        case OP::RRA:
+        }
+        else if constexpr (instr.name == OP::RRA)
+        {
             m_rra();
-            break;
-        case OP::RRCA:
+        }
+        else if constexpr (instr.name == OP::RRCA)
+        {
             m_rrca();
-            break;
-        case OP::RST:
+        }
+        else if constexpr (instr.name == OP::RST)
+        {
             m_call(y * 8);
-            break;
-        case OP::STOP:
+        }
+        else if constexpr (instr.name == OP::STOP)
+        {
             m_stop();
+        }
+    }
+
+    u16 SM83::m_fetch_opcode()
+    {
+        m_instr_counter++;
+
+        if (m_block == nullptr || (u16)(m_block->start + m_block->instrs[m_block_index].offset) != m_registers.PC)
+        {
+            m_block = m_find_block(m_registers.PC);
+            m_block_index = 0;
+        }
+
+        if (m_block == nullptr)
+        {
+            m_prefetch = nullptr;
+
+            u16 opcode = m_fetch();
+            if (opcode == 0xCB)
+            {
+                opcode = 0x100 | m_fetch();
+            }
+
+            return opcode;
+        }
+
+        // Instruction bytes come from the block but every fetch still takes its M-cycle
+        const auto& instr = m_block->instrs[m_block_index];
+        const int opcode_length = (instr.opcode > 0xFF) ? 2 : 1;
+
+        m_prefetch = m_block->bytes.data() + instr.offset + opcode_length;
+        m_registers.PC += opcode_length;
+        m_advance_cycle(opcode_length);
+
+        if (++m_block_index == m_block->instrs.size())
+        {
+            m_block = nullptr;
+        }
+
+        return instr.opcode;
+    }
+
+    u8 SM83::m_fetch()
+    {
+        if (m_prefetch != nullptr)
+        {
+            m_advance_cycle();
+            m_registers.PC++;
+            return *m_prefetch++;
+        }
+
+        return m_read(m_registers.PC++);
+    }
+
+    SM83::block* SM83::m_find_block(u16 pc)
+    {
+        int bank = m_mmu->code_bank(pc);
+        if (bank < 0)
+        {
+            m_track_idle_loop(nullptr);
+            return nullptr;
+        }
+
+        u32 key = ((u32)bank << 16) | pc;
+        const bool in_ram = (bank == CODE_BANK_WRAM || bank == CODE_BANK_HRAM);
+        auto& blocks = in_ram ? m_ram_blocks : m_rom_blocks;
+
+        auto it = blocks.find(key);
+        if (it == blocks.end())
+        {
+            it = blocks.emplace(key, block{}).first;
+            m_build_block(it->second, pc, bank);
+
+            if (in_ram && !it->second.instrs.empty())
+            {
+                for (int page = m_code_page(it->second.start); page <= m_code_page(it->second.end - 1); ++page)
+                {
+                    m_code_pages[page] = true;
+                }
+            }
+        }
+
+        block* b = it->second.instrs.empty() ? nullptr : &it->second;
+        m_track_idle_loop(b);
+
+        return b;
+    }
+
+    void SM83::m_build_block(block& b, u16 pc, int bank)
+    {
+        // Blocks never cross the end of the memory region they start in
+        int limit = 0;
+        switch (bank)
+        {
+        case CODE_BANK_BOOT_ROM:
+            limit = 0x0100;
+            break;
+        case CODE_BANK_WRAM:
+            limit = 0xE000;
+            break;
+        case CODE_BANK_HRAM:
+            limit = 0xFFFF;
             break;
         default:
-            //fmt::print("no op : {}", instr.name);
+            limit = (pc < 0x4000) ? 0x4000 : 0x8000;
             break;
         }
-    }
 
-    u8 SM83::m_fetch()
-    {
-        return m_read(m_registers.PC++);
+        b.start = pc;
+
+        int adr = pc;
+        while (b.instrs.size() < MAX_BLOCK_SIZE && adr < limit)
+        {
+            u16 opcode = m_mmu->read(adr);
+            if (opcode == 0xCB)
+            {
+                if (adr + 1 >= limit)
+                {
+                    break;
+                }
+
+                opcode = 0x100 | m_mmu->read(adr + 1);
+            }
+
+            if (adr + length_table[opcode] > limit)
+            {
+                break;
+            }
+
+            b.instrs.push_back({ .opcode = opcode, .offset = (u16)(adr - pc) });
+            for (int i = 0; i < length_table[opcode]; ++i)
+            {
+                b.bytes.push_back(m_mmu->read(adr + i));
+            }
+
+            adr += length_table[opcode];
+
+            if (ends_block(opcode))
+            {
+                break;
+            }
+        }
+
+        b.end = adr;
+        b.idle_loop = m_is_idle_loop(b);
+    }
+
+    // Loops made of a memory read, a test of the value read and a conditional jump back,
+    // or of a single jump to itself. Every iteration is the same as the previous one
+    // until something else than the CPU changes memory.
+    bool SM83::m_is_idle_loop(const block& b)
+    {
+        if (b.instrs.empty())
+        {
+            return false;
+        }
+
+        const auto& last = b.instrs.back();
+        const OP& jump = decode_table[last.opcode];
+        const u8* operands = b.bytes.data() + last.offset + 1;
+
+        u16 target = 0;
+        if (jump.name == OP::JR || jump.name == OP::JR_CC)
+        {
+            target = b.start + last.offset + 2 + (i8)operands[0];
+        }
+        else if (jump.name == OP::JP || jump.name == OP::JP_CC)
+        {
+            target = combine(operands[0], operands[1]);
+        }
+        else
+        {
+            return false;
+        }
+
+        if (target != b.start)
+        {
+            return false;
+        }
+
+        if (b.instrs.size() == 1)
+        {
+            return jump.name == OP::JR || jump.name == OP::JP;
+        }
+
+        if (jump.name != OP::JR_CC && jump.name != OP::JP_CC)
+        {
+            return false;
+        }
+
+        auto is_test = [](const OP& op)
+        {
+            // AND, XOR, OR and CP, ADC/SBC would carry state over from the previous iteration
+            return (op.name == OP::ALU && op.y >= 4 && !op.args[0].indirect)
+                || (op.name == OP::BIT && op.args[0].name == A && !op.args[0].indirect);
+        };
+
+        const OP& first = decode_table[b.instrs[0].opcode];
+
+        if (b.instrs.size() == 2)
+        {
+            // BIT b, (HL)
+            return first.name == OP::BIT && first.args[0].name == HL && first.args[0].indirect;
+        }
+
+        if (b.instrs.size() == 3)
+        {
+            const reg_s src = first.args[1];
+            const bool polling_load = first.name == OP::LD && first.args[0].name == A && !first.args[0].indirect
+                && src.indirect && (src.name == n || src.name == nn || src.name == C
+                    || src.name == BC || src.name == DE || src.name == HL);
+
+            return polling_load && is_test(decode_table[b.instrs[1].opcode]);
+        }
+
+        return false;
+    }
+
+    int SM83::m_polled_address(const block& b)
+    {
+        const OP& first = decode_table[b.instrs[0].opcode];
+        const reg_s src = (first.name == OP::BIT) ? first.args[0] : first.args[1];
+        const u8* operands = b.bytes.data() + 1;
+
+        if (b.instrs.size() == 1 || !src.indirect)
+        {
+            return -1;
+        }
+
+        switch (src.name)
+        {
+        case n:
+            return 0xFF00 + operands[0];
+        case nn:
+            return combine(operands[0], operands[1]);
+        case C:
+            return 0xFF00 + m_registers.C;
+        case BC:
+            return m_registers.BC;
+        case DE:
+            return m_registers.DE;
+        default:
+            return m_registers.HL;
+        }
+    }
+
+    void SM83::m_track_idle_loop(const block* b)
+    {
+        // Back at the start of the loop right after a full iteration that saw no timer or PPU
+        // event : the following ones can only differ once an interrupt is raised or mode/LY change.
+        // DIV and TIMA keep counting in between, loops polling them are left alone.
+        if (b != nullptr && b == m_idle_block && !m_ei_delay)
+        {
+            const int adr = m_polled_address(*b);
+            const u64 iteration = m_cycle_counter - m_idle_start;
+
+            if (iteration > 0 && iteration <= m_idle_quiet && adr != 0xFF00 + DIV && adr != 0xFF00 + TIMA)
+            {
+                // The iteration being fetched still runs, it has to start before the deadline
+                const u64 idle = std::min(m_idle_cycles(), m_deadline - m_cycle_counter - 1);
+                m_skip(idle - idle % iteration);
+            }
+        }
+
+        m_idle_block = (b != nullptr && b->idle_loop) ? b : nullptr;
+        m_idle_start = m_cycle_counter;
+        m_idle_quiet = (m_idle_block != nullptr) ? m_idle_cycles() : 0;
+    }
+
+    void SM83::m_invalidate_code(u16 adr)
+    {
+        if (adr <= 0x7FFF || adr == 0xFF00 + BANK)
+        {
+            // MBC register or boot rom unmapping, the rest of the block may be gone
+            m_block = nullptr;
+            m_code_changed = true;
+            return;
+        }
+
+        int page = m_code_page(adr);
+        if (page < 0 || !m_code_pages[page])
+        {
+            return;
+        }
+
+        m_block = nullptr;
+        m_code_changed = true;
+        m_code_pages[page] = false;
+
+        std::erase_if(m_ram_blocks, [this, page](const auto& item)
+        {
+            const block& b = item.second;
+            return !b.instrs.empty() && m_code_page(b.start) <= page && page <= m_code_page(b.end - 1);
+        });
+    }
+
+    int SM83::m_code_page(u16 adr)
+    {
+        if (0xC000 <= adr && adr <= 0xFDFF)
+        {
+            // Echo RAM aliases WRAM
+            return (adr & 0x1FFF) >> 8;
+        }
+        else if (0xFF80 <= adr && adr <= 0xFFFE)
+        {
+            return 32;
+        }
+
+        return -1;
+    }
+
+#if defined(PGBE_DYNAREC)
+    constexpr u32 JIT_THRESHOLD = 16; // block executions before it gets translated
+
+    // Maps the x86 flags LAHF stores in AH (CF bit 0, AF bit 4, ZF bit 6) to the SM83 C, H and Z flags
+    constexpr auto jit_flags = []()
+    {
+        std::array<u8, 256> res{};
+
+        for (int i = 0; i < 256; ++i)
+        {
+            res[i] = ((i & 0x40) ? 0x80 : 0) | ((i & 0x10) ? 0x20 : 0) | ((i & 0x01) ? 0x10 : 0);
+        }
+
+        return res;
+    }();
+
+    constexpr bool is_reg_8(reg_s r)
+    {
+        return !r.indirect && (r.name == A || r.name == B || r.name == C || r.name == D
+            || r.name == E || r.name == H || r.name == L);
+    }
+
+    constexpr bool is_imm_8(reg_s r)
+    {
+        return !r.indirect && r.name == n;
+    }
+
+    // Register-only loads, ALU ops and INC/DEC, m_translate emits them as x86-64 code
+    constexpr bool is_native(u16 opcode)
+    {
+        if (opcode > 0xFF)
+        {
+            return false;
+        }
+
+        const OP& op = decode_table[opcode];
+        return op.name == OP::NOP
+            || (op.name == OP::LD && is_reg_8(op.args[0]) && (is_reg_8(op.args[1]) || is_imm_8(op.args[1])))
+            || (op.name == OP::ALU && (is_reg_8(op.args[0]) || is_imm_8(op.args[0])))
+            || ((op.name == OP::INC || op.name == OP::DEC) && is_reg_8(op.args[0]));
+    }
+
+    void SM83::set_dynarec(bool enabled)
+    {
+        m_dynarec_enabled = enabled && m_dynarec.available();
+    }
+
+    bool SM83::m_run_translated()
+    {
+        if (!m_dynarec_enabled)
+        {
+            return false;
+        }
+
+        // Translations are only entered from the first instruction of their block
+        if (m_block != nullptr && (u16)(m_block->start + m_block->instrs[m_block_index].offset) == m_registers.PC)
+        {
+            return false;
+        }
+
+        block* b = m_find_block(m_registers.PC);
+        m_block = b;
+        m_block_index = 0;
+
+        if (b == nullptr)
+        {
+            return false;
+        }
+
+        if (b->code == nullptr)
+        {
+            if (++b->hits < JIT_THRESHOLD)
+            {
+                return false;
+            }
+
+            m_translate(*b);
+            if (b->code == nullptr)
+            {
+                return false;
+            }
+        }
+
+        m_block = nullptr;
+        m_prefetch = nullptr;
+        m_code_changed = false;
+
+        // Translated code works on F directly
+        m_sync_flags();
+
+        // Single steps outside of run_for, like the interpreter
+        const bool single_step = m_cycle_counter >= m_deadline || m_ppu->frame_completed();
+        m_jit_retired = 0;
+        b->code(this, &m_registers, jit_flags.data(), single_step ? 1 : m_jit_limit());
+
+        // Left in the middle of the block : the interpreter picks it up from there
+        // instead of building a new block at every exit point
+        if (!m_code_changed && b->start < m_registers.PC && m_registers.PC < b->end)
+        {
+            for (std::size_t i = 0; i < b->instrs.size(); ++i)
+            {
+                if (b->start + b->instrs[i].offset == m_registers.PC)
+                {
+                    m_block = b;
+                    m_block_index = i;
+                    break;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // Register usage of the translated code : rbx = &m_registers, r12 = this, r13 = jit_flags,
+    // r14d = M-cycles run since the last call back, r15d = limit from m_jit_limit.
+    // Register-only loads, ALU ops and INC/DEC run natively, everything that may touch memory
+    // (and so I/O) goes back to the interpreter handler. Native instructions only add their fetch
+    // cycles to r14d, nothing can happen until the next event so they are ticked at once when r14d
+    // reaches the limit, before an interpreted instruction or at the end of the block. The block
+    // is left as soon as the interpreter loop would have done something else than fetching the
+    // next instruction (see m_jit_exit).
+    void SM83::m_translate(block& b)
+    {
+        auto reg_offset = [](reg_name r) -> u8
+        {
+            switch (r)
+            {
+            case A: return offsetof(registers, A);
+            case B: return offsetof(registers, B);
+            case C: return offsetof(registers, C);
+            case D: return offsetof(registers, D);
+            case E: return offsetof(registers, E);
+            case H: return offsetof(registers, H);
+            default: return offsetof(registers, L);
+            }
+        };
+
+        const u8 f = offsetof(registers, F);
+        const u8 a = offsetof(registers, A);
+
+        auto& e = m_dynarec;
+
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            e.begin();
+
+            // push rbx; push r12; push r13; push r14; push r15
+            e.emit({ 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 });
+            // mov r12, rdi; mov rbx, rsi; mov r13, rdx; mov r15d, ecx; xor r14d, r14d
+            e.emit({ 0x49, 0x89, 0xFC, 0x48, 0x89, 0xF3, 0x49, 0x89, 0xD5, 0x41, 0x89, 0xCF, 0x45, 0x31, 0xF6 });
+
+            // pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+            const std::initializer_list<u8> epilogue{ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 };
+
+            u16 pc = b.start;
+            for (std::size_t i = 0; i < b.instrs.size(); ++i)
+            {
+                const auto& instr = b.instrs[i];
+                const OP& op = decode_table[instr.opcode];
+                const u8* operands = b.bytes.data() + instr.offset + ((instr.opcode > 0xFF) ? 2 : 1);
+                const reg_s arg1 = op.args[0];
+                const reg_s arg2 = op.args[1];
+                const bool last = (i + 1 == b.instrs.size());
+
+                const u16 instr_pc = pc;
+                pc += length_table[instr.opcode];
+
+                const bool native = is_native(instr.opcode);
+                if (!native || op.name == OP::NOP)
+                {
+                }
+                else if (op.name == OP::LD && is_reg_8(arg1) && is_reg_8(arg2))
+                {
+                    // movzx eax, byte [rbx + src]; mov [rbx + dst], al
+                    e.emit({ 0x0F, 0xB6, 0x43, reg_offset(arg2.name), 0x88, 0x43, reg_offset(arg1.name) });
+                }
+                else if (op.name == OP::LD && is_reg_8(arg1) && is_imm_8(arg2))
+                {
+                    // mov byte [rbx + dst], n
+                    e.emit({ 0xC6, 0x43, reg_offset(arg1.name), operands[0] });
+                }
+                else if (op.name == OP::ALU && (is_reg_8(arg1) || is_imm_8(arg1)))
+                {
+                    constexpr std::array<u8, 8> x86_alu{ 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+
+                    if (is_reg_8(arg1))
+                    {
+                        // movzx ecx, byte [rbx + src]
+                        e.emit({ 0x0F, 0xB6, 0x4B, reg_offset(arg1.name) });
+                    }
+                    else
+                    {
+                        // mov cl, n
+                        e.emit({ 0xB1, operands[0] });
+                    }
+
+                    // mov al, [rbx + A]
+                    e.emit({ 0x8A, 0x43, a });
+
+                    if (op.y == 1 || op.y == 3)
+                    {
+                        // ADC/SBC : mov dl, [rbx + F]; shr dl, 5 moves the carry into CF
+                        e.emit({ 0x8A, 0x53, f, 0xC0, 0xEA, 0x05 });
+                    }
+
+                    // <op> al, cl; lahf
+                    e.emit({ x86_alu[op.y], 0xC8, 0x9F });
+
+                    if (op.y != 7)
+                    {
+                        // mov [rbx + A], al
+                        e.emit({ 0x88, 0x43, a });
+                    }
+
+                    // movzx eax, ah; mov al, [r13 + rax]
+                    e.emit({ 0x0F, 0xB6, 0xC4, 0x41, 0x8A, 0x44, 0x05, 0x00 });
+
+                    switch (op.y)
+                    {
+                    case 2:
+                    case 3:
+                    case 7:
+                        // or al, N
+                        e.emit({ 0x0C, 0x40 });
+                        break;
+                    case 4:
+                        // and al, Z; or al, H
+                        e.emit({ 0x24, 0x80, 0x0C, 0x20 });
+                        break;
+                    case 5:
+                    case 6:
+                        // and al, Z
+                        e.emit({ 0x24, 0x80 });
+                        break;
+                    }
+
+                    // mov [rbx + F], al
+                    e.emit({ 0x88, 0x43, f });
+                }
+                else
+                {
+                    // inc/dec byte [rbx + r]; lahf; movzx eax, ah; mov al, [r13 + rax]; and al, Z | H
+                    e.emit({ 0xFE, (u8)((op.name == OP::INC) ? 0x43 : 0x4B), reg_offset(arg1.name), 0x9F });
+                    e.emit({ 0x0F, 0xB6, 0xC4, 0x41, 0x8A, 0x44, 0x05, 0x00, 0x24, 0xA0 });
+                    // C is left untouched : mov cl, [rbx + F]; and cl, C; or al, cl
+                    e.emit({ 0x8A, 0x4B, f, 0x80, 0xE1, 0x10, 0x08, 0xC8 });
+
+                    if (op.name == OP::DEC)
+                    {
+                        // or al, N
+                        e.emit({ 0x0C, 0x40 });
+                    }
+
+                    // mov [rbx + F], al
+                    e.emit({ 0x88, 0x43, f });
+                }
+
+                if (native)
+                {
+                    // add r14d, m_cycles
+                    e.emit({ 0x41, 0x83, 0xC6, length_table[instr.opcode] });
+
+                    if (!last)
+                    {
+                        // cmp r14d, r15d; jb next instruction (over the 43 bytes of the sync below)
+                        e.emit({ 0x45, 0x39, 0xFE, 0x72, 0x2B });
+                    }
+
+                    // mov rdi, r12; mov esi, r14d; mov edx, next_pc; mov rax, m_jit_sync
+                    e.emit({ 0x4C, 0x89, 0xE7, 0x44, 0x89, 0xF6, 0xBA });
+                    e.emit_32(pc | (u32)(i + 1) << 16);
+                    e.emit({ 0x48, 0xB8 });
+                    e.emit_64(reinterpret_cast<u64>(&SM83::m_jit_sync));
+                }
+                else
+                {
+                    // mov rdi, r12; mov esi, opcode; mov rdx, operands
+                    e.emit({ 0x4C, 0x89, 0xE7, 0xBE });
+                    e.emit_32(instr.opcode);
+                    e.emit({ 0x48, 0xBA });
+                    e.emit_64(reinterpret_cast<u64>(operands));
+                    // mov ecx, r14d; mov r8d, pc; mov r9d, next_native; mov rax, m_jit_interpret
+                    e.emit({ 0x44, 0x89, 0xF1, 0x41, 0xB8 });
+                    e.emit_32(instr_pc | (u32)(i + 1) << 16);
+                    e.emit({ 0x41, 0xB9 });
+                    e.emit_32(!last && is_native(b.instrs[i + 1].opcode));
+                    e.emit({ 0x48, 0xB8 });
+                    e.emit_64(reinterpret_cast<u64>(&SM83::m_jit_interpret));
+                }
+                // call rax
+                e.emit({ 0xFF, 0xD0 });
+
+                if (!last)
+                {
+                    // test eax, eax; jnz over the epilogue
+                    e.emit({ 0x85, 0xC0, 0x75, 0x0A });
+                }
+
+                e.emit(epilogue);
+
+                if (!last)
+                {
+                    // mov r15d, eax; xor r14d, r14d
+                    e.emit({ 0x41, 0x89, 0xC7, 0x45, 0x31, 0xF6 });
+                }
+            }
+
+            if (void* code = e.end())
+            {
+                b.code = reinterpret_cast<decltype(b.code)>(code);
+                return;
+            }
+
+            // The code buffer is full, start over from scratch
+            for (auto& [key, rb] : m_rom_blocks)
+            {
+                rb.code = nullptr;
+            }
+            for (auto& [key, rb] : m_ram_blocks)
+            {
+                rb.code = nullptr;
+            }
+            e.clear();
+
+            // Or it couldn't be made writable or executable, keep interpreting
+            if (!e.available())
+            {
+                m_dynarec_enabled = false;
+                return;
+            }
+        }
+    }
+
+    bool SM83::m_jit_exit(u16 next_pc)
+    {
+        return m_registers.PC != next_pc
+            || m_code_changed
+            || m_halted
+            || m_halt_bug
+            || m_ei_delay
+            || (m_ime && (m_IF & m_IE & 0x1F) != 0)
+            || m_cycle_counter >= m_deadline
+            || m_ppu->frame_completed();
+    }
+
+    u32 SM83::m_jit_limit()
+    {
+        // The M-cycle running the next event is ticked, one that only reaches the deadline too
+        return (u32)std::min<u64>({ m_timer->idle_cycles() + 1, m_deadline - m_cycle_counter, 0xFFFF });
+    }
+
+    void SM83::m_retire_translated(u32 pc)
+    {
+        // Native instructions are only counted at the next call out of the block
+        const u32 retired = pc >> 16;
+        m_instr_counter += retired - m_jit_retired;
+        m_jit_retired = retired;
+    }
+
+    u32 SM83::m_jit_sync(SM83* cpu, u32 m_cycles, u32 next_pc)
+    {
+        cpu->m_retire_translated(next_pc);
+        next_pc &= 0xFFFF;
+
+        cpu->m_registers.PC = next_pc;
+        cpu->m_advance_cycle(m_cycles);
+
+        return cpu->m_jit_exit(next_pc) ? 0 : cpu->m_jit_limit();
+    }
+
+    u32 SM83::m_jit_interpret(SM83* cpu, u32 opcode, const u8* operands, u32 m_cycles, u32 pc, bool next_native)
+    {
+        cpu->m_retire_translated(pc);
+        pc &= 0xFFFF;
+
+        const int opcode_length = (opcode > 0xFF) ? 2 : 1;
+        const u16 next_pc = pc + length_table[opcode];
+
+        // Below the limit, no event is due during the native instructions before this one
+        if (m_cycles > 0)
+        {
+            cpu->m_skip(m_cycles);
+        }
+
+        cpu->m_registers.PC = pc + opcode_length;
+        cpu->m_advance_cycle(opcode_length);
+
+        cpu->m_prefetch = operands;
+        (cpu->*m_handlers[opcode])();
+        cpu->m_prefetch = nullptr;
+
+        if (cpu->m_jit_exit(next_pc))
+        {
+            return 0;
+        }
+
+        if (!next_native)
+        {
+            return 1;
+        }
+
+        // Translated code works on F directly
+        cpu->m_sync_flags();
+        return cpu->m_jit_limit();
     }
+#endif
 
     u16 SM83::m_fetch_word()
     {
@@ -643,250 +1703,168 @@ namespace PGBE
         return m_mmu->read(adr);
     }
 
-    reg_v SM83::m_get_reg(reg_s r)
+    void SM83::m_write(u16 adr, u8 v)
+    {
+        m_advance_cycle();
+        m_mmu->write(adr, v);
+        m_invalidate_code(adr);
+    }
+
+    template<reg_name r>
+    u8& SM83::m_reg_8()
     {
-        switch (r.name)
+        static_assert(r == A || r == B || r == C || r == D || r == E || r == H || r == L, "m_reg_8");
+
+        if constexpr (r == A) return m_registers.A;
+        else if constexpr (r == B) return m_registers.B;
+        else if constexpr (r == C) return m_registers.C;
+        else if constexpr (r == D) return m_registers.D;
+        else if constexpr (r == E) return m_registers.E;
+        else if constexpr (r == H) return m_registers.H;
+        else return m_registers.L;
+    }
+
+    template<reg_name r>
+    u16& SM83::m_reg_16()
+    {
+        static_assert(r == AF || r == BC || r == DE || r == HL || r == SP, "m_reg_16");
+
+        if constexpr (r == AF)
         {
-        case A:
-            return m_registers.A;
-        case B:
-            return m_registers.B;
-        case C:
-            if (r.indirect)
-            {
-                return m_read(0xFF00 + m_registers.C);
-            }
-            return m_registers.C;
-        case D:
-            return m_registers.D;
-        case E:
-            return m_registers.E;
-        case H:
-            return m_registers.H;
-        case L:
-            return m_registers.L;
-        case AF:
-            if (r.indirect)
-            {
-                return m_read(m_registers.AF);
-            }
+            m_sync_flags();
             return m_registers.AF;
-        case BC:
-            if (r.indirect)
-            {
-                return m_read(m_registers.BC);
-            }
-            return m_registers.BC;
-        case DE:
-            if (r.indirect)
-            {
-                return m_read(m_registers.DE);
-            }
-            return m_registers.DE;
-        case HL:
-            if (r.indirect)
-            {
-                return m_read(m_registers.HL);
-            }
-            return m_registers.HL;
-        case HL_inc:
-            if (r.indirect)
-            {
-                return m_read(m_registers.HL++);
-            }
-            return m_registers.HL++;
-        case HL_dec:
-            if (r.indirect)
-            {
-                return m_read(m_registers.HL--);
-            }
-            return m_registers.HL--;
-        case SP:
-            if (r.indirect)
-            {
-                return m_read(m_registers.SP);
-            }
-            return m_registers.SP;
-        case SP_d:
-            if (r.indirect)
-            {
-                return m_read(m_registers.SP + (i8)m_fetch());
-            }
-            return u16(m_registers.SP + (i8)m_fetch());
-        case n:
-            if (r.indirect)
+        }
+        else if constexpr (r == BC) return m_registers.BC;
+        else if constexpr (r == DE) return m_registers.DE;
+        else if constexpr (r == HL) return m_registers.HL;
+        else return m_registers.SP;
+    }
+
+    template<reg_s r>
+    u8 SM83::m_get_8()
+    {
+        if constexpr (!r.indirect)
+        {
+            if constexpr (r.name == n)
             {
-                return m_read(0xFF00 + m_fetch());
+                return m_fetch();
             }
-            return m_fetch();
-        case nn:
-            if (r.indirect)
+            else
             {
-                return m_read(m_fetch_word());
+                return m_reg_8<r.name>();
             }
-            return m_fetch_word();
-            return m_fetch_word();
-        default:
-            throw "m_get_reg";
+        }
+        else if constexpr (r.name == C)
+        {
+            return m_read(0xFF00 + m_registers.C);
+        }
+        else if constexpr (r.name == HL_inc)
+        {
+            return m_read(m_registers.HL++);
+        }
+        else if constexpr (r.name == HL_dec)
+        {
+            return m_read(m_registers.HL--);
+        }
+        else if constexpr (r.name == n)
+        {
+            return m_read(0xFF00 + m_fetch());
+        }
+        else if constexpr (r.name == nn)
+        {
+            return m_read(m_fetch_word());
+        }
+        else
+        {
+            return m_read(m_reg_16<r.name>());
         }
     }
 
-    void SM83::m_write(u16 adr, u8 v)
+    template<reg_s r>
+    void SM83::m_set_8(u8 v)
     {
-        m_advance_cycle();
-        m_mmu->write(adr, v);
+        if constexpr (!r.indirect)
+        {
+            m_reg_8<r.name>() = v;
+        }
+        else if constexpr (r.name == C)
+        {
+            m_write(0xFF00 + m_registers.C, v);
+        }
+        else if constexpr (r.name == HL_inc)
+        {
+            m_write(m_registers.HL++, v);
+        }
+        else if constexpr (r.name == HL_dec)
+        {
+            m_write(m_registers.HL--, v);
+        }
+        else if constexpr (r.name == n)
+        {
+            m_write(0xFF00 + m_fetch(), v);
+        }
+        else if constexpr (r.name == nn)
+        {
+            m_write(m_fetch_word(), v);
+        }
+        else
+        {
+            m_write(m_reg_16<r.name>(), v);
+        }
     }
 
-    void SM83::m_set_reg(reg_s r, reg_v v)
+    template<reg_s r>
+    u16 SM83::m_get_16()
     {
-        u16 adr = 0;
-
-        switch (r.name)
+        if constexpr (r.name == SP_d)
         {
-        case A:
-            m_registers.A = std::get<u8>(v);
-            break;
-        case B:
-            m_registers.B = std::get<u8>(v);
-            break;
-        case C:
-            if (r.indirect)
-            {
-                adr = 0xFF00 + m_registers.C;
-            }
-            else
-            {
-                m_registers.C = std::get<u8>(v);
-            }
-            break;
-        case D:
-            m_registers.D = std::get<u8>(v);
-            break;
-        case E:
-            m_registers.E = std::get<u8>(v);
-            break;
-        case H:
-            m_registers.H = std::get<u8>(v);
-            break;
-        case L:
-            m_registers.L = std::get<u8>(v);
-            break;
-        case AF:
-            if (r.indirect)
-            {
-                adr = m_registers.AF;
-            }
-            else
-            {
-                m_registers.AF = std::get<u16>(v);
-            }
-            break;
-        case BC:
-            if (r.indirect)
-            {
-                adr = m_registers.BC;
-            }
-            else
-            {
-                m_registers.BC = std::get<u16>(v);
-            }
-            break;
-        case DE:
-            if (r.indirect)
-            {
-                adr = m_registers.DE;
-            }
-            else
-            {
-                m_registers.DE = std::get<u16>(v);
-            }
-            break;
-        case HL:
-            if (r.indirect)
-            {
-                adr = m_registers.HL;
-            }
-            else
-            {
-                m_registers.HL = std::get<u16>(v);
-            }
-            break;
-        case HL_inc:
-            if (r.indirect)
-            {
-                adr = m_registers.HL;
-            }
-            else
-            {
-                m_registers.HL = std::get<u16>(v);
-            }
-            m_registers.HL++;
-            break;
-        case HL_dec:
-            if (r.indirect)
-            {
-                adr = m_registers.HL;
-            }
-            else
-            {
-                m_registers.HL = std::get<u16>(v);
-            }
-            m_registers.HL--;
-            break;
-        case SP:
-            if (r.indirect)
-            {
-                adr = m_registers.SP;
-            }
-            else
-            {
-                m_registers.SP = std::get<u16>(v);
-            }
-            break;
-        case n:
-            if (r.indirect)
-            {
-                adr = 0xFF00 + m_fetch();
-            }
-            break;
-        case nn:
-            if (r.indirect)
-            {
-                adr = m_fetch_word();
-            }
-            break;
-        default:
-            throw "m_set_reg";
+            return u16(m_registers.SP + (i8)m_fetch());
+        }
+        else if constexpr (r.name == nn)
+        {
+            return m_fetch_word();
         }
+        else
+        {
+            return m_reg_16<r.name>();
+        }
+    }
 
-        if (r.indirect)
+    template<reg_s r>
+    void SM83::m_set_16(u16 v)
+    {
+        if constexpr (r.indirect)
         {
-            if (std::holds_alternative<u16>(v))
-            {
-                u16 tmp = std::get<u16>(v);
-                m_write(adr, LSB(tmp));
-                m_write(adr + 1, MSB(tmp));
-            }
-            else
-            {
-                m_write(adr, std::get<u8>(v));
-            }
+            // LD (nn), SP
+            u16 adr = m_fetch_word();
+            m_write(adr, LSB(v));
+            m_write(adr + 1, MSB(v));
+        }
+        else
+        {
+            m_reg_16<r.name>() = v;
         }
     }
 
     bool SM83::m_nz()
     {
-        return !m_registers.flags.z;
+        return !m_z();
     }
 
     bool SM83::m_z()
     {
+#if defined(PGBE_LAZY_FLAGS)
+        if (m_lazy.op != LAZY_NONE)
+        {
+            return m_lazy.res == 0;
+        }
+#endif
         return m_registers.flags.z;
     }
 
     bool SM83::m_nc()
     {
-        return !m_registers.flags.c;
+        return !m_c();
     }
 
     bool SM83::m_c()
@@ -894,81 +1872,122 @@ namespace PGBE
         return m_registers.flags.c;
     }
 
-    void SM83::m_ld(reg_s lv, reg_s rv)
+    template<int cc>
+    bool SM83::m_cond()
     {
-        auto v = m_get_reg(rv);
-        m_set_reg(lv, v);
+        if constexpr (cc < 0)
+        {
+            return true;
+        }
+        else
+        {
+            return (this->*m_cc[cc])();
+        }
+    }
 
-        if (lv.name == HL && rv.name == SP_d)
+    template<reg_s lv, reg_s rv>
+    void SM83::m_ld()
+    {
+        if constexpr (is_16_bit(lv) || is_16_bit(rv))
         {
-            u16 spd_v = std::get<u16>(v);
-            i8 d = spd_v - m_registers.SP;
+            u16 v = m_get_16<rv>();
+            if constexpr ((lv.name == SP && rv.name == HL) || rv.name == SP_d)
+            {
+                // LD SP, HL and LD HL, SP + d spend an extra cycle on the 16-bit transfer
+                m_advance_cycle();
+            }
+            m_set_16<lv>(v);
 
-            m_registers.flags.h = ((m_registers.SP & 0x0F) + (d & 0x0F)) > 0x0F;
-            m_registers.flags.c = ((m_registers.SP & 0xFF) + (d & 0xFF)) > 0xFF;
-            m_registers.flags.z = false;
-            m_registers.flags.n = false;
+            if constexpr (lv.name == HL && rv.name == SP_d)
+            {
+                i8 d = v - m_registers.SP;
+
+                m_sync_flags();
+                m_registers.flags.h = ((m_registers.SP & 0x0F) + (d & 0x0F)) > 0x0F;
+                m_registers.flags.c = ((m_registers.SP & 0xFF) + (d & 0xFF)) > 0xFF;
+                m_registers.flags.z = false;
+                m_registers.flags.n = false;
+            }
+        }
+        else
+        {
+            m_set_8<lv>(m_get_8<rv>());
         }
     }
 
-    void SM83::m_dec(reg_t v)
+    void SM83::m_dec(u8& v)
     {
-        std::visit(overload
-            {
-                [](u16* arg) { --(*arg); },
-                [this](u8* arg)
-                {
-                    auto old = (*arg)--;
-                    m_registers.flags.n = true;
-                    m_registers.flags.z = (*arg == 0);
-                    m_registers.flags.h = ((old & 0x0F) - (*arg & 0x0F)) < 0;
-                },
-            }, v);
+        auto old = v--;
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_DEC, old, 1, v };
+#else
+        m_registers.flags.n = true;
+        m_registers.flags.z = (v == 0);
+        m_registers.flags.h = ((old & 0x0F) - (v & 0x0F)) < 0;
+#endif
     }
 
-    void SM83::m_inc(reg_t v)
+    void SM83::m_dec(u16& v)
     {
-        std::visit(overload
-            {
-                [](u16* arg) { ++(*arg); },
-                [this](u8* arg)
-                {
-                    auto old = (*arg)++;
-                    m_registers.flags.n = false;
-                    m_registers.flags.z = (*arg == 0);
-                    m_registers.flags.h = ((old & 0x0F) == 0x0F);
-                },
-            }, v);
+        m_advance_cycle();
+        --v;
+    }
+
+    void SM83::m_inc(u8& v)
+    {
+        auto old = v++;
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_INC, old, 1, v };
+#else
+        m_registers.flags.n = false;
+        m_registers.flags.z = (v == 0);
+        m_registers.flags.h = ((old & 0x0F) == 0x0F);
+#endif
+    }
+
+    void SM83::m_inc(u16& v)
+    {
+        m_advance_cycle();
+        ++v;
     }
 
     void SM83::m_add(u8 v)
     {
         u16 tmp = m_registers.A + v;
 
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_ADD, m_registers.A, v, (u8)tmp };
+#else
         m_registers.flags.z = ((tmp & 0xFF) == 0);
         m_registers.flags.n = false;
         m_registers.flags.h = ((m_registers.A & 0x0F) + (v & 0x0F)) >= 0x10;
+#endif
         m_registers.flags.c = (tmp > 0xFF);
 
         m_registers.A = (u8)tmp;
     }
 
-    void SM83::m_add_16(reg_s lv, reg_s rv)
+    template<reg_s lv, reg_s rv>
+    void SM83::m_add_16()
     {
         uint32_t res = 0;
+        m_sync_flags();
         m_registers.flags.h = false;
 
-        if (lv.name == SP)
+        if constexpr (lv.name == SP)
         {
             i8 d = m_fetch();
+            m_advance_cycle(2);
             res = m_registers.SP + d;
             m_registers.flags.h = ((m_registers.SP & 0x0F) + (d & 0x0F)) >= 0x10;
             m_registers.flags.c = ((m_registers.SP & 0xFF) + (d & 0xFF)) >= 0x100;
             m_registers.SP = res;
+            m_registers.flags.z = false;
         }
-        else if (lv.name == HL)
+        else
         {
-            auto v = std::get<u16>(m_get_reg(rv));
+            auto v = m_get_16<rv>();
+            m_advance_cycle();
             res = m_registers.HL + v;
             m_registers.flags.h = ((m_registers.HL & 0x0FFF) + (v & 0x0FFF)) >= 0x1000;
 
@@ -976,16 +1995,12 @@ namespace PGBE
             m_registers.flags.c = (res > 0xFFFF);
         }
 
-        if (lv.name == SP || rv.name == SP_d)
-        {
-            m_registers.flags.z = false;
-        }
-
         m_registers.flags.n = false;
     }
 
     void SM83::m_adc(u8 v)
     {
+        m_discard_flags();
         u16 tmp = m_registers.A + v + m_registers.flags.c;
 
         m_registers.flags.z = ((tmp & 0xFF) == 0);
@@ -1000,9 +2015,13 @@ namespace PGBE
     {
         int16_t tmp = m_registers.A - v;
 
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_SUB, m_registers.A, v, (u8)tmp };
+#else
         m_registers.flags.z = ((tmp & 0xFF) == 0);
         m_registers.flags.n = true;
         m_registers.flags.h = ((m_registers.A & 0x0F) - (tmp & 0x0F)) < 0;
+#endif
         m_registers.flags.c = (tmp < 0);
 
         m_registers.A = (u8)tmp;
@@ -1010,6 +2029,7 @@ namespace PGBE
 
     void SM83::m_sbc(u8 v)
     {
+        m_discard_flags();
         int16_t tmp = m_registers.A - v - m_registers.flags.c;
 
         m_registers.flags.z = ((tmp & 0xFF) == 0);
@@ -1024,9 +2044,13 @@ namespace PGBE
     {
         m_registers.A &= v;
 
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_AND, m_registers.A, v, m_registers.A };
+#else
         m_registers.flags.z = (m_registers.A == 0);
         m_registers.flags.n = false;
         m_registers.flags.h = true;
+#endif
         m_registers.flags.c = false;
     }
 
@@ -1034,9 +2058,13 @@ namespace PGBE
     {
         m_registers.A ^= v;
 
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_OR, m_registers.A, v, m_registers.A };
+#else
         m_registers.flags.z = (m_registers.A == 0);
         m_registers.flags.n = false;
         m_registers.flags.h = false;
+#endif
         m_registers.flags.c = false;
     }
 
@@ -1044,9 +2072,13 @@ namespace PGBE
     {
         m_registers.A |= v;
 
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_OR, m_registers.A, v, m_registers.A };
+#else
         m_registers.flags.z = (m_registers.A == 0);
         m_registers.flags.n = false;
         m_registers.flags.h = false;
+#endif
         m_registers.flags.c = false;
     }
 
@@ -1054,14 +2086,76 @@ namespace PGBE
     {
         int16_t tmp = m_registers.A - v;
 
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy = { LAZY_SUB, m_registers.A, v, (u8)tmp };
+#else
         m_registers.flags.z = (tmp & (0x00FF)) == 0;
         m_registers.flags.n = true;
         m_registers.flags.h = ((m_registers.A & 0x0F) - (tmp & 0x0F)) < 0;
+#endif
         m_registers.flags.c = (tmp < 0);
     }
 
+    void SM83::m_sync_flags()
+    {
+#if defined(PGBE_LAZY_FLAGS)
+        if (m_lazy.op != LAZY_NONE)
+        {
+            m_compute_flags();
+        }
+#endif
+    }
+
+    void SM83::m_discard_flags()
+    {
+#if defined(PGBE_LAZY_FLAGS)
+        m_lazy.op = LAZY_NONE;
+#endif
+    }
+
+#if defined(PGBE_LAZY_FLAGS)
+    void SM83::m_compute_flags()
+    {
+        auto& f = m_registers.flags;
+
+        switch (m_lazy.op)
+        {
+        case LAZY_NONE:
+            return;
+        case LAZY_ADD:
+            f.n = false;
+            f.h = ((m_lazy.a & 0x0F) + (m_lazy.b & 0x0F)) >= 0x10;
+            break;
+        case LAZY_SUB:
+            f.n = true;
+            f.h = (m_lazy.a & 0x0F) < (m_lazy.b & 0x0F);
+            break;
+        case LAZY_AND:
+            f.n = false;
+            f.h = true;
+            break;
+        case LAZY_OR:
+            f.n = false;
+            f.h = false;
+            break;
+        case LAZY_INC:
+            f.n = false;
+            f.h = ((m_lazy.a & 0x0F) == 0x0F);
+            break;
+        case LAZY_DEC:
+            f.n = true;
+            f.h = ((m_lazy.a & 0x0F) == 0x00);
+            break;
+        }
+
+        f.z = (m_lazy.res == 0);
+        m_lazy.op = LAZY_NONE;
+    }
+#endif
+
     void SM83::m_cpl()
     {
+        m_sync_flags();
         m_registers.flags.h = true;
         m_registers.flags.n = true;
         m_registers.A ^= 0xFF;
@@ -1069,6 +2163,7 @@ namespace PGBE
 
     void SM83::m_scf()
     {
+        m_sync_flags();
         m_registers.flags.h = false;
         m_registers.flags.n = false;
         m_registers.flags.c = true;
@@ -1076,6 +2171,7 @@ namespace PGBE
 
     void SM83::m_ccf()
     {
+        m_sync_flags();
         m_registers.flags.h = false;
         m_registers.flags.n = false;
         m_registers.flags.c ^= 0x01;
@@ -1083,6 +2179,7 @@ namespace PGBE
 
     void SM83::m_daa()
     {
+        m_sync_flags();
         u8 n = m_registers.A;
 
         if (m_registers.flags.n)
@@ -1117,43 +2214,57 @@ namespace PGBE
         m_registers.A = n;
     }
 
-    void SM83::m_call(u16 nn, std::function<bool(void)> cond)
+    template<int cc>
+    void SM83::m_call(u16 nn)
     {
-        if (!cond || cond())
+        if (m_cond<cc>())
         {
             m_push(m_registers.PC);
             m_registers.PC = nn;
         }
     }
 
-    void SM83::m_jp(std::function<bool(void)> cond)
+    template<int cc>
+    void SM83::m_jp()
     {
         u16 nn = m_fetch_word();
-        if (!cond || cond())
+        if (m_cond<cc>())
         {
+            m_advance_cycle();
             m_registers.PC = nn;
         }
     }
 
-    void SM83::m_jr(std::function<bool(void)> cond)
+    template<int cc>
+    void SM83::m_jr()
     {
         i8 d = m_fetch();
-        if (!cond || cond())
+        if (m_cond<cc>())
         {
+            m_advance_cycle();
             m_registers.PC += d;
         }
     }
 
-    void SM83::m_ret(std::function<bool(void)> cond)
+    template<int cc>
+    void SM83::m_ret()
     {
+        if constexpr (cc >= 0)
+        {
+            // the condition check takes its own cycle
+            m_advance_cycle();
+            if (!m_cond<cc>())
+            {
+                return;
+            }
+        }
+
         u8 lsb = m_read(m_registers.SP);
         u8 msb = m_read(m_registers.SP + 1);
 
-        if (!cond || cond())
-        {
-            m_registers.PC = combine(lsb, msb);
-            m_registers.SP += 2;
-        }
+        m_registers.PC = combine(lsb, msb);
+        m_registers.SP += 2;
+        m_advance_cycle();
     }
 
     void SM83::m_reti()
@@ -1164,6 +2275,7 @@ namespace PGBE
 
     void SM83::m_rlc(u8& v)
     {
+        m_discard_flags();
         m_registers.flags.h = false;
         m_registers.flags.n = false;
         m_registers.flags.c = (v & 0x80) > 0;
@@ -1179,6 +2291,7 @@ namespace PGBE
 
     void SM83::m_rrc(u8& v)
     {
+        m_discard_flags();
         m_registers.flags.h = false;
         m_registers.flags.n = false;
         m_registers.flags.c = (v & 0x01) > 0;
@@ -1194,6 +2307,7 @@ namespace PGBE
 
     void SM83::m_rl(u8& v)
     {
+        m_discard_flags();
         u8 n = m_registers.flags.c;
         m_registers.flags.h = false;
         m_registers.flags.n = false;
@@ -1207,6 +2321,7 @@ namespace PGBE
 
     void SM83::m_rr(u8& v)
     {
+        m_discard_flags();
         bool carry = m_registers.flags.c;
         m_registers.flags.h = false;
         m_registers.flags.n = false;
@@ -1223,6 +2338,7 @@ namespace PGBE
 
     void SM83::m_sla(u8& v)
     {
+        m_discard_flags();
         m_registers.flags.h = false;
         m_registers.flags.n = false;
         m_registers.flags.c = (v & 0x80) > 0;
@@ -1233,6 +2349,7 @@ namespace PGBE
 
     void SM83::m_sra(u8& v)
     {
+        m_discard_flags();
         bool high_bit_was_set = (v & 0x80) > 0;
         m_registers.flags.h = false;
         m_registers.flags.n = false;
@@ -1249,6 +2366,7 @@ namespace PGBE
 
     void SM83::m_swap(u8& v)
     {
+        m_discard_flags();
         auto right = (v & 0x0F) << 4;
         auto left = (v & 0xF0) >> 4;
 
@@ -1262,6 +2380,7 @@ namespace PGBE
 
     void SM83::m_srl(u8& v)
     {
+        m_discard_flags();
         m_registers.flags.h = false;
         m_registers.flags.n = false;
         m_registers.flags.c = (v & 0x01) > 0;
@@ -1303,6 +2422,7 @@ namespace PGBE
 
     void SM83::m_bit(u8 v, u8 i)
     {
+        m_discard_flags();
         m_registers.flags.z = !is_set_bit(v, i);
         m_registers.flags.n = false;
         m_registers.flags.h = true;
@@ -1340,6 +2460,8 @@ namespace PGBE
             return "";
         }
 
+        m_sync_flags();
+
         std::string res =
             fmt::format("A: {:02X} F: {:02X} B: {:02X} C: {:02X} D: {:02X} E: {:02X} H: {:02X} L: {:02X} SP: {:04X} PC: 00:{:04X}",
                 m_registers.A, m_registers.F, m_registers.B, m_registers.C, m_registers.D, m_registers.E,
@@ -1376,6 +2498,11 @@ namespace PGBE
 
     void SM83::m_isr()
     {
+        if (!m_ei_delay && !(m_ime && (m_IF & m_IE & 0x1F)))
+        {
+            return;
+        }
+
         for (int i = 0; i < 5; ++i)
         {
             if (m_ime && is_set_bit(m_IE, i) && is_set_bit(m_IF, i))
@@ -1387,8 +2514,9 @@ namespace PGBE
             }
         }
 
-        if (m_prev_op.name == OP::EI)
+        if (m_ei_delay)
         {
+            m_ei_delay = false;
             m_ime = true;
         }
     }
@@ -1412,6 +2540,7 @@ namespace PGBE
 
     void SM83::m_advance_cycle(int m_cycles)
     {
+        m_cycle_counter += m_cycles;
         for (int i = 0; i < m_cycles; ++i)
         {
             m_timer->advance_cycle();
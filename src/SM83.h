@@ -1,15 +1,13 @@
 #pragma once
+#include "Dynarec.h"
 #include "MMU.h"
 #include "Timer.h"
-#include <variant>
-
-using std::placeholders::_1;
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace PGBE
 {
-    using reg_t = std::variant<u8*, u16*>;
-    using reg_v = std::variant<u8, u16>;
-
     enum reg_name
     {
         None,
@@ -89,15 +87,36 @@ namespace PGBE
     class SM83
     {
     public:
-        SM83(MMU* mmu, Timer* t);
+        SM83(MMU* mmu, Timer* t, PPU* ppu);
 
+        // Executes a single instruction (or one halted cycle)
         void run();
+        // Keeps executing until budget M-cycles elapsed or the PPU completed a frame.
+        // Halted stretches and idle polling loops are jumped over up to the next timer or PPU event
+        void run_for(u64 budget);
+        u64 cycles();
+        // Instructions retired since power on, translated ones included. Not part of the save state
+        u64 instructions();
         void reset();
+        // DMG register values at the end of the boot rom, to start at 0x0100 without one
+        void skip_boot();
+
+        // Registers and interrupt state, the code cache is rebuilt
+        void save_state(StateWriter& w);
+        void load_state(StateReader& r);
+#if defined(PGBE_DYNAREC)
+        // Translated blocks are only run when enabled (the default)
+        void set_dynarec(bool enabled);
+#endif
         std::string dump();
         std::string print_dis(OP op);
     private:
         MMU* m_mmu;
         Timer* m_timer;
+        PPU* m_ppu;
+        u64 m_cycle_counter; // M-cycles
+        u64 m_instr_counter;
+        u64 m_deadline; // end of the current run_for, 0 outside of it
         struct registers
         {
             registers()
@@ -167,27 +186,143 @@ namespace PGBE
         bool m_ime, m_halted, m_halt_bug;
         u8& m_IF, & m_IE;
 
-        OP m_prev_op;
+        bool m_ei_delay;
+
+#if defined(PGBE_LAZY_FLAGS)
+        // Last ALU op that set Z, N and H, they are only computed from it when something reads them. C stays eager
+        enum lazy_op : u8
+        {
+            LAZY_NONE, // F is up to date
+            LAZY_ADD,
+            LAZY_SUB, // SUB and CP
+            LAZY_AND,
+            LAZY_OR, // OR and XOR
+            LAZY_INC,
+            LAZY_DEC,
+        };
+
+        struct lazy_flags
+        {
+            lazy_op op = LAZY_NONE;
+            u8 a; // operands
+            u8 b;
+            u8 res;
+        } m_lazy;
 
-        OP m_decode(u8 opcode);
-        void m_execute(OP instr);
+        void m_compute_flags();
+#endif
+
+        // Decoded straight-line run of instructions, the raw bytes hold the immediate operands
+        struct block
+        {
+            struct instr
+            {
+                u16 opcode; // decode table index
+                u16 offset; // in bytes
+            };
+
+            u16 start;
+            u16 end;
+            std::vector<instr> instrs;
+            std::vector<u8> bytes;
+            bool idle_loop = false; // loop only polling memory, see m_track_idle_loop
+#if defined(PGBE_DYNAREC)
+            u32 hits = 0;
+            void (*code)(SM83* cpu, void* regs, const u8* flags, u32 limit) = nullptr;
+#endif
+        };
+
+        // Keyed by (bank << 16 | PC), ROM blocks never need to be invalidated
+        std::unordered_map<u32, block> m_rom_blocks;
+        // WRAM and HRAM blocks are dropped when a page they cover is written to
+        std::unordered_map<u32, block> m_ram_blocks;
+        std::array<bool, 33> m_code_pages; // 32 WRAM pages and HRAM
+
+        const block* m_block; // block being executed, nullptr outside of cacheable memory
+        std::size_t m_block_index;
+        const u8* m_prefetch; // operands of the current instruction when it comes from a block
+
+        const block* m_idle_block; // idle loop entered last, nullptr when another block ran since
+        u64 m_idle_start;
+        u64 m_idle_quiet;
+
+        bool m_code_changed; // set when a write may have modified or unmapped the code being run
+
+        block* m_find_block(u16 pc);
+        void m_build_block(block& b, u16 pc, int bank);
+        bool m_is_idle_loop(const block& b);
+        int m_polled_address(const block& b);
+        void m_track_idle_loop(const block* b);
+        void m_invalidate_code(u16 adr);
+        int m_code_page(u16 adr);
+
+#if defined(PGBE_DYNAREC)
+        Dynarec m_dynarec;
+        bool m_dynarec_enabled;
+        u32 m_jit_retired; // instructions of the running block already counted
+
+        bool m_run_translated();
+        void m_translate(block& b);
+        bool m_jit_exit(u16 next_pc);
+        // M-cycles translated code can run without ticking : up to the next event and short of the deadline,
+        // only valid when m_jit_exit is false
+        u32 m_jit_limit();
+        // Called from translated code with the M-cycles it ran since the last call, they return
+        // the next limit or 0 to leave the block. The PC comes with the number of instructions
+        // of the block run so far in its upper half
+        static u32 m_jit_sync(SM83* cpu, u32 m_cycles, u32 next_pc);
+        // The limit is only computed when the next instruction runs natively
+        static u32 m_jit_interpret(SM83* cpu, u32 opcode, const u8* operands, u32 m_cycles, u32 pc, bool next_native);
+        void m_retire_translated(u32 pc);
+#endif
+
+        // One instantiation of m_execute per opcode, indexed like the decode table
+        using handler = void (SM83::*)();
+        static const std::array<handler, 512> m_handlers;
+
+        template<std::size_t... I>
+        static constexpr std::array<handler, 512> m_make_handlers(std::index_sequence<I...>);
+
+        template<OP instr>
+        void m_execute();
         void m_advance_cycle(int m_cycles = 1);
+        void m_run_until(u64 target);
+
+        // Idle cycles left before the next timer or PPU event, within the run_for budget
+        u64 m_idle_cycles();
+        void m_skip(u64 m_cycles);
+
+        bool m_handle_halt();
 
         // Memory access
         u8 m_read(u16 adr);
+        u16 m_fetch_opcode();
         u8 m_fetch();
         u16 m_fetch_word();
         void m_write(u16 adr, u8 v);
 
-        reg_v m_get_reg(reg_s r);
-        void m_set_reg(reg_s r, reg_v v);
+        // Operand access, resolved at compile time
+        template<reg_name r>
+        u8& m_reg_8();
+        template<reg_name r>
+        u16& m_reg_16();
+
+        template<reg_s r>
+        u8 m_get_8();
+        template<reg_s r>
+        void m_set_8(u8 v);
+        template<reg_s r>
+        u16 m_get_16();
+        template<reg_s r>
+        void m_set_16(u16 v);
 
         // Interrupt handler
         void m_isr();
 
         // ALU
         void m_add(u8 v);
-        void m_add_16(reg_s lv, reg_s rv);
+        template<reg_s lv, reg_s rv>
+        void m_add_16();
         void m_adc(u8 v);
         void m_sub(u8 v);
         void m_sbc(u8 v);
@@ -195,16 +330,23 @@ namespace PGBE
         void m_xor(u8 v);
         void m_or(u8 v);
         void m_cp(u8 v);
+        // Brings F up to date, needed before any other instruction reads or partially sets the flags
+        void m_sync_flags();
+        // Drops the pending flags of the last ALU op, for instructions that overwrite Z, N and H without reading them
+        void m_discard_flags();
 
-        void m_dec(reg_t v);
-        void m_inc(reg_t v);
+        void m_dec(u8& v);
+        void m_dec(u16& v);
+        void m_inc(u8& v);
+        void m_inc(u16& v);
 
         void m_cpl();
         void m_scf();
         void m_ccf();
         void m_daa();
 
-        void m_ld(reg_s lv, reg_s rv);
+        template<reg_s lv, reg_s rv>
+        void m_ld();
 
         void m_pop(u16& r);
         void m_push(u16 r);
@@ -228,12 +370,18 @@ namespace PGBE
         bool m_z();
         bool m_nc();
         bool m_c();
-
-        // Jump
-        void m_call(u16 adr, std::function<bool(void)> cc = nullptr);
-        void m_jp(std::function<bool(void)> cc = nullptr);
-        void m_jr(std::function<bool(void)> cc = nullptr);
-        void m_ret(std::function<bool(void)> cc = nullptr);
+        template<int cc>
+        bool m_cond();
+
+        // Jump, cc indexes m_cc at compile time (-1 means unconditional)
+        template<int cc = -1>
+        void m_call(u16 adr);
+        template<int cc = -1>
+        void m_jp();
+        template<int cc = -1>
+        void m_jr();
+        template<int cc = -1>
+        void m_ret();
         void m_reti();
 
         // Bit op
@@ -245,64 +393,40 @@ namespace PGBE
         void m_stop();
         void m_halt();
 
-        const std::array<reg_s, 8> m_r
-        {
-            reg_s{ B, false },
-            reg_s{ C, false },
-            reg_s{ D, false },
-            reg_s{ E, false },
-            reg_s{ H, false },
-            reg_s{ L, false },
-            reg_s{ HL, true },
-            reg_s{ A, false },
-        };
-
-        const std::array<reg_s, 4> m_rp
-        {
-            reg_s{ BC, false },
-            reg_s{ DE, false },
-            reg_s{ HL, false },
-            reg_s{ SP, false },
-        };
-
-        const std::array<reg_s, 4> m_rp2
-        {
-            reg_s{ BC, false },
-            reg_s{ DE, false },
-            reg_s{ HL, false },
-            reg_s{ AF, false },
-        };
+        using alu_fn = void (SM83::*)(u8);
+        using rot_fn = void (SM83::*)(u8&);
+        using cc_fn = bool (SM83::*)();
 
-        const std::array<std::function<void(u8)>, 8> m_alu
+        static constexpr std::array<alu_fn, 8> m_alu
         {
-            std::bind(&SM83::m_add, this, _1),
-            std::bind(&SM83::m_adc, this, _1),
-            std::bind(&SM83::m_sub, this, _1),
-            std::bind(&SM83::m_sbc, this, _1),
-            std::bind(&SM83::m_and, this, _1),
-            std::bind(&SM83::m_xor, this, _1),
-            std::bind(&SM83::m_or, this, _1),
-            std::bind(&SM83::m_cp, this, _1),
+            &SM83::m_add,
+            &SM83::m_adc,
+            &SM83::m_sub,
+            &SM83::m_sbc,
+            &SM83::m_and,
+            &SM83::m_xor,
+            &SM83::m_or,
+            &SM83::m_cp,
         };
 
-        const std::array<std::function<void(u8&)>, 8> m_rot
+        static constexpr std::array<rot_fn, 8> m_rot
         {
-            std::bind(&SM83::m_rlc, this, _1),
-            std::bind(&SM83::m_rrc, this, _1),
-            std::bind(&SM83::m_rl, this, _1),
-            std::bind(&SM83::m_rr, this, _1),
-            std::bind(&SM83::m_sla, this, _1),
-            std::bind(&SM83::m_sra, this, _1),
-            std::bind(&SM83::m_swap, this, _1),
-            std::bind(&SM83::m_srl, this, _1),
+            &SM83::m_rlc,
+            &SM83::m_rrc,
+            &SM83::m_rl,
+            &SM83::m_rr,
+            &SM83::m_sla,
+            &SM83::m_sra,
+            &SM83::m_swap,
+            &SM83::m_srl,
         };
 
-        const std::array<std::function<bool(void)>, 4> m_cc
+        static constexpr std::array<cc_fn, 4> m_cc
         {
-            std::bind(&SM83::m_nz, this),
-            std::bind(&SM83::m_z, this),
-            std::bind(&SM83::m_nc, this),
-            std::bind(&SM83::m_c, this),
+            &SM83::m_nz,
+            &SM83::m_z,
+            &SM83::m_nc,
+            &SM83::m_c,
         };
     };
 }
\ No newline at end of file
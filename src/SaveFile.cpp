@@ -0,0 +1,173 @@
+#include "SaveFile.h"
+#include <chrono>
+#include <fmt/core.h>
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PGBE
+{
+    // A crash of the host loses at most that much play, a crash of the emulator nothing when mapped
+    constexpr auto FLUSH_INTERVAL = std::chrono::seconds(1);
+
+    SaveFile::SaveFile() :
+        m_data(nullptr),
+        m_size(0),
+        m_mapping(nullptr),
+        m_fd(-1),
+        m_path(),
+        m_copy(),
+        m_snapshot(),
+        m_data_mutex(),
+        m_dirty(false),
+        m_mutex(),
+        m_wake(),
+        m_stop(false),
+        m_thread()
+    {
+    }
+
+    SaveFile::~SaveFile()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_wake.notify_one();
+            m_thread.join();
+        }
+
+        // Also what changed without being marked, like the clock state. Nothing was opened when
+        // open() gave up, flushing the empty copy would truncate the file of another instance
+        if (m_data != nullptr)
+        {
+            m_dirty.store(true, std::memory_order_relaxed);
+            m_flush();
+        }
+
+#if !defined(_WIN32)
+        if (m_mapping != nullptr)
+        {
+            munmap(m_mapping, m_size);
+        }
+
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+#endif
+    }
+
+    std::unique_ptr<SaveFile> SaveFile::open(std::string_view path, std::size_t size)
+    {
+        std::unique_ptr<SaveFile> save(new SaveFile());
+        save->m_path = std::string{path};
+        save->m_size = size;
+
+#if !defined(_WIN32)
+        int fd = ::open(save->m_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            fmt::print("Can't open save file {}...\n", path);
+            return nullptr;
+        }
+
+        // Two instances writing the same file would overwrite each other
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            fmt::print("Save file {} is already in use...\n", path);
+            ::close(fd);
+            return nullptr;
+        }
+
+        // Longer files are kept as they are, the RAM is at their start
+        struct stat st;
+        if (fstat(fd, &st) != 0 || ((std::size_t)st.st_size < size && ftruncate(fd, size) != 0))
+        {
+            fmt::print("Can't resize save file {}...\n", path);
+            ::close(fd);
+            return nullptr;
+        }
+
+        save->m_fd = fd;
+
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            save->m_mapping = p;
+            save->m_data = static_cast<u8*>(p);
+        }
+#endif
+
+        if (save->m_data == nullptr)
+        {
+            save->m_copy.assign(size, 0);
+
+            std::ifstream input(save->m_path, std::ios::binary);
+            input.read(reinterpret_cast<char*>(save->m_copy.data()), size);
+
+            save->m_data = save->m_copy.data();
+        }
+
+        save->m_thread = std::thread(&SaveFile::m_run, save.get());
+
+        return save;
+    }
+
+    std::span<u8> SaveFile::data()
+    {
+        return { m_data, m_size };
+    }
+
+    void SaveFile::m_run()
+    {
+        std::unique_lock lock(m_mutex);
+        while (!m_stop)
+        {
+            m_wake.wait_for(lock, FLUSH_INTERVAL, [this] { return m_stop; });
+
+            lock.unlock();
+            m_flush();
+            lock.lock();
+        }
+    }
+
+    void SaveFile::m_flush()
+    {
+        // Cleared first, a write racing with the flush is written back by the next one
+        if (!m_dirty.exchange(false))
+        {
+            return;
+        }
+
+#if !defined(_WIN32)
+        if (m_mapping != nullptr)
+        {
+            msync(m_mapping, m_size, MS_SYNC);
+            return;
+        }
+#endif
+
+        {
+            std::lock_guard lock(m_data_mutex);
+            m_snapshot = m_copy;
+        }
+
+        std::ofstream output(m_path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(m_snapshot.data()), m_snapshot.size());
+
+        if (!output)
+        {
+            fmt::print("Can't write save file {}...\n", m_path);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+#include "integers.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace PGBE
+{
+    // Battery-backed cartridge RAM, mapped from a .sav file. A background thread writes it
+    // back when it is dirty so the emulation never waits on the disk.
+    class SaveFile
+    {
+    public:
+        // Stops the flush thread and writes the data back
+        ~SaveFile();
+
+        SaveFile(const SaveFile&) = delete;
+        SaveFile& operator=(const SaveFile&) = delete;
+
+        // Creates the file filled with 0s if needed, nullptr when it can't be opened or
+        // is already used by another instance
+        static std::unique_ptr<SaveFile> open(std::string_view path, std::size_t size);
+
+        std::span<u8> data();
+        // Every change to data() goes through it, what it writes is written back on the next flush
+        template<class F>
+        void write(F&& write_data)
+        {
+            std::lock_guard lock(m_data_mutex);
+            write_data();
+            m_dirty.store(true, std::memory_order_relaxed);
+        }
+    private:
+        SaveFile();
+
+        void m_run();
+        void m_flush();
+
+        u8* m_data;
+        std::size_t m_size;
+        void* m_mapping;
+        int m_fd;
+        std::string m_path;
+        // Without a mapping the whole file is rewritten from a snapshot of this copy, taken under
+        // m_data_mutex as the emulation writes to it
+        std::vector<u8> m_copy;
+        std::vector<u8> m_snapshot;
+        std::mutex m_data_mutex;
+
+        std::atomic<bool> m_dirty;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_stop;
+        std::thread m_thread;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+#include "integers.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+namespace PGBE
+{
+    // A save state is this header followed by the fields of every component, raw in host byte order
+    // and always in the same order. Anything written differently bumps SAVE_STATE_VERSION.
+    constexpr u32 SAVE_STATE_MAGIC = 0x53424750; // "PGBS"
+    constexpr u32 SAVE_STATE_VERSION = 1;
+
+    // The framebuffer was left out, loading keeps the one drawn
+    constexpr u32 SAVE_STATE_NO_FRAMEBUFFER = 1 << 0;
+
+    struct save_state_header
+    {
+        u32 magic;
+        u32 version;
+        u64 size; // header included
+        u32 cartridge; // see MMU::cartridge_id
+        u32 flags;
+    };
+
+    // Writes into a buffer it doesn't own, never allocates. Without one it only counts the bytes.
+    class StateWriter
+    {
+    public:
+        StateWriter() :
+            m_out(),
+            m_counting(true),
+            m_size(0)
+        {
+        }
+
+        explicit StateWriter(std::span<u8> out) :
+            m_out(out),
+            m_counting(false),
+            m_size(0)
+        {
+        }
+
+        template<typename T>
+        void put(const T& v)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            put_bytes({ reinterpret_cast<const u8*>(&v), sizeof(T) });
+        }
+
+        void put_bytes(std::span<const u8> bytes)
+        {
+            if (!m_counting && m_size + bytes.size() <= m_out.size())
+            {
+                std::memcpy(m_out.data() + m_size, bytes.data(), bytes.size());
+            }
+            m_size += bytes.size();
+        }
+
+        // Keeps the layout when a component has nothing to save there
+        void put_zeros(std::size_t count)
+        {
+            if (!m_counting && m_size + count <= m_out.size())
+            {
+                std::memset(m_out.data() + m_size, 0, count);
+            }
+            m_size += count;
+        }
+
+        std::size_t size() const
+        {
+            return m_size;
+        }
+    private:
+        std::span<u8> m_out;
+        bool m_counting;
+        std::size_t m_size;
+    };
+
+    // Reads what StateWriter wrote, past the end everything reads as 0
+    class StateReader
+    {
+    public:
+        explicit StateReader(std::span<const u8> in) :
+            m_in(in),
+            m_pos(0)
+        {
+        }
+
+        template<typename T>
+        T get()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                return get<u8>() != 0;
+            }
+            else
+            {
+                T v{};
+                get_bytes({ reinterpret_cast<u8*>(&v), sizeof(T) });
+                return v;
+            }
+        }
+
+        void get_bytes(std::span<u8> bytes)
+        {
+            const std::size_t available = (m_pos < m_in.size()) ? std::min(bytes.size(), m_in.size() - m_pos) : 0;
+            std::memcpy(bytes.data(), m_in.data() + m_pos, available);
+            std::memset(bytes.data() + available, 0, bytes.size() - available);
+            m_pos += bytes.size();
+        }
+
+        void skip(std::size_t count)
+        {
+            m_pos += count;
+        }
+    private:
+        std::span<const u8> m_in;
+        std::size_t m_pos;
+    };
+}
\ No newline at end of file
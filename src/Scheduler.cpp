@@ -0,0 +1,183 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace PGBE
+{
+    Scheduler::Scheduler() :
+        now(0),
+        m_heap(),
+        m_size(0),
+        m_order(0)
+    {
+    }
+
+    void Scheduler::schedule(u64 t_cycle, event_phase phase, event_type type, u8 payload)
+    {
+        // Bounded by MAX_PENDING_EVENTS, the event is dropped rather than written past the heap
+        assert(m_size < CAPACITY);
+        if (m_size == CAPACITY)
+        {
+            return;
+        }
+
+        m_heap[m_size] = event
+        {
+            .key = (t_cycle << PHASE_BITS) | phase,
+            .order = m_order++,
+            .type = type,
+            .payload = payload
+        };
+
+        m_sift_up(m_size++);
+    }
+
+    void Scheduler::cancel(event_type type)
+    {
+        std::size_t i = 0;
+        while (i < m_size)
+        {
+            if (m_heap[i].type != type)
+            {
+                ++i;
+                continue;
+            }
+
+            // Fill the hole with the last event and restore the heap around it
+            m_heap[i] = m_heap[--m_size];
+            if (i < m_size)
+            {
+                m_sift_up(i);
+                m_sift_down(i);
+            }
+
+            // The event moved to i may be of the cancelled type too
+            i = 0;
+        }
+    }
+
+    void Scheduler::clear()
+    {
+        m_size = 0;
+    }
+
+    u64 Scheduler::next()
+    {
+        return (m_size == 0) ? NEVER : t_cycle_of(m_heap[0]);
+    }
+
+    bool Scheduler::pop_due(u64 t_cycle, event& e)
+    {
+        if (m_size == 0 || t_cycle_of(m_heap[0]) > t_cycle)
+        {
+            return false;
+        }
+
+        e = m_heap[0];
+        m_heap[0] = m_heap[--m_size];
+        m_sift_down(0);
+
+        return true;
+    }
+
+    u64 Scheduler::t_cycle_of(const event& e)
+    {
+        return e.key >> PHASE_BITS;
+    }
+
+    void Scheduler::save_state(StateWriter& w)
+    {
+        w.put(now);
+        w.put(m_order);
+        w.put((u64)m_size);
+
+        // Always the whole heap, every state of a cartridge has the same size
+        for (std::size_t i = 0; i < CAPACITY; ++i)
+        {
+            const event e = (i < m_size) ? m_heap[i] : event{};
+            w.put(e.key);
+            w.put(e.order);
+            w.put(e.type);
+            w.put(e.payload);
+        }
+    }
+
+    bool Scheduler::load_state(StateReader& r)
+    {
+        now = r.get<u64>();
+        m_order = r.get<u64>();
+        const u64 size = r.get<u64>();
+        bool valid = (size <= MAX_PENDING_EVENTS);
+        m_size = valid ? size : 0;
+
+        for (std::size_t i = 0; i < CAPACITY; ++i)
+        {
+            auto& e = m_heap[i];
+            e.key = r.get<u64>();
+            e.order = r.get<u64>();
+            e.type = r.get<event_type>();
+            e.payload = r.get<u8>();
+
+            if (i < m_size && e.type > EVENT_PPU_STAT)
+            {
+                valid = false;
+            }
+        }
+
+        if (!valid)
+        {
+            m_size = 0;
+        }
+
+        return valid;
+    }
+
+    bool Scheduler::m_before(const event& a, const event& b)
+    {
+        return (a.key < b.key) || (a.key == b.key && a.order < b.order);
+    }
+
+    void Scheduler::m_sift_up(std::size_t i)
+    {
+        while (i > 0)
+        {
+            std::size_t parent = (i - 1) / 2;
+            if (!m_before(m_heap[i], m_heap[parent]))
+            {
+                break;
+            }
+
+            std::swap(m_heap[i], m_heap[parent]);
+            i = parent;
+        }
+    }
+
+    void Scheduler::m_sift_down(std::size_t i)
+    {
+        while (true)
+        {
+            std::size_t smallest = i;
+            std::size_t left = 2 * i + 1;
+            std::size_t right = left + 1;
+
+            if (left < m_size && m_before(m_heap[left], m_heap[smallest]))
+            {
+                smallest = left;
+            }
+
+            if (right < m_size && m_before(m_heap[right], m_heap[smallest]))
+            {
+                smallest = right;
+            }
+
+            if (smallest == i)
+            {
+                break;
+            }
+
+            std::swap(m_heap[i], m_heap[smallest]);
+            i = smallest;
+        }
+    }
+}
\ No newline at end of file
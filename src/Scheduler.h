@@ -0,0 +1,76 @@
+#pragma once
+#include "integers.h"
+#include "SaveState.h"
+#include <array>
+#include <cstddef>
+#include <limits>
+
+namespace PGBE
+{
+    enum event_type : u8
+    {
+        EVENT_TIMA_OVERFLOW, // TIMA bump from FF to 00
+        EVENT_TIMA_RELOAD, // TIMA overflowed 4 T-cycles earlier
+        EVENT_OAM_DMA, // payload : source page
+        EVENT_PPU_MODE, // end of the current PPU mode
+        EVENT_PPU_STAT, // LCDC, STAT, LYC or the PPU mode changed on the previous T-cycle, last type
+    };
+
+    // Order of the events due on the same T-cycle
+    enum event_phase : u8
+    {
+        PHASE_TIMER = 0, // TIMA, DMA
+        PHASE_STAT = 1, // STAT interrupt and LCD on/off check
+        PHASE_PPU = 2, // PPU mode changes
+    };
+
+    struct event
+    {
+        u64 key; // (T-cycle << PHASE_BITS) | phase
+        u64 order; // events with the same key run in scheduling order
+        event_type type;
+        u8 payload;
+    };
+
+    // Most events pending at once : a TIMA overflow, the reloads of the two overflows TIMA writes can
+    // fit in 4 T-cycles, an OAM DMA and the one restarting it, the end of the PPU mode, and the STAT
+    // checks of a mode change, a register write and a frame reset, all due on the next T-cycle
+    constexpr std::size_t MAX_PENDING_EVENTS = 1 + 2 + 2 + 1 + 3;
+
+    // Pending events sorted by absolute T-cycle in a fixed-capacity binary min-heap
+    class Scheduler
+    {
+    public:
+        static constexpr std::size_t CAPACITY = 32;
+        static_assert(CAPACITY >= MAX_PENDING_EVENTS, "The heap can't fill up");
+        static constexpr u64 NEVER = std::numeric_limits<u64>::max();
+        static constexpr int PHASE_BITS = 2;
+
+        Scheduler();
+
+        void schedule(u64 t_cycle, event_phase phase, event_type type, u8 payload = 0);
+        // Drops every pending event of that type
+        void cancel(event_type type);
+        void clear();
+
+        // T-cycle of the earliest event, NEVER when there is none
+        u64 next();
+        // Removes the earliest event into e if it is due at or before that T-cycle
+        bool pop_due(u64 t_cycle, event& e);
+        static u64 t_cycle_of(const event& e);
+
+        void save_state(StateWriter& w);
+        // False, leaving no event pending, when the state holds more events than can be pending or unknown ones
+        bool load_state(StateReader& r);
+
+        u64 now; // T-cycles since power on, the current one when ticking
+    private:
+        std::array<event, CAPACITY> m_heap;
+        std::size_t m_size;
+        u64 m_order;
+
+        static bool m_before(const event& a, const event& b);
+        void m_sift_up(std::size_t i);
+        void m_sift_down(std::size_t i);
+    };
+}
\ No newline at end of file
@@ -6,33 +6,39 @@ namespace PGBE
     Timer::Timer(MMU* mmu, PPU* ppu) :
         m_ppu(ppu),
         m_mmu(mmu),
-        m_div(mmu->io_reg->at(DIV)),
-        m_tima(mmu->io_reg->at(TIMA)),
-        m_tma(mmu->io_reg->at(TMA)),
-        m_tac(mmu->io_reg->at(TAC)),
+        m_div(mmu->io_reg.at(DIV)),
+        m_tima(mmu->io_reg.at(TIMA)),
+        m_tma(mmu->io_reg.at(TMA)),
+        m_tac(mmu->io_reg.at(TAC)),
         m_internal_div(mmu->internal_div),
-        m_IF(mmu->io_reg->at(IF)),
-        m_timers()
+        m_IF(mmu->io_reg.at(IF)),
+        m_scheduler(mmu->scheduler)
     {
         m_div = 0;
         m_internal_div = 0;
         m_prev_and_res = false;
         m_prev_tima = 0;
+        m_synced = 0;
+        m_ticking = false;
     }
 
-    void Timer::schedule_task(int delay, std::function<void()> callback)
+    void Timer::save_state(StateWriter& w)
     {
-        Task t
-        {
-            .count = 0,
-            .delay = delay,
-            .callback = callback
-        };
+        w.put(m_prev_and_res);
+        w.put(m_prev_tima);
+        w.put(m_synced);
+        w.put(m_ticking);
+    }
 
-        m_timers.push_back(t);
+    void Timer::load_state(StateReader& r)
+    {
+        m_prev_and_res = r.get<bool>();
+        m_prev_tima = r.get<u8>();
+        m_synced = r.get<u64>();
+        m_ticking = r.get<bool>();
     }
 
-    void Timer::m_update_clock()
+    int Timer::m_tima_bit()
     {
         const std::array<int, 4> _bit_pos
         {
@@ -42,10 +48,15 @@ namespace PGBE
             7
         };
 
+        return _bit_pos.at(m_tac & 0b0011);
+    }
+
+    void Timer::m_update_clock(u64 t_cycle)
+    {
         m_div = (((++m_internal_div) & 0xFF00) >> 8);
 
         // TIMA is fucked up dude
-        int pos = _bit_pos.at(m_tac & 0b0011);
+        int pos = m_tima_bit();
         bool div_bit = (m_internal_div >> pos) & 0b0001;
         bool and_res = div_bit && m_timer_enabled();
         if (!and_res && m_prev_and_res)
@@ -56,41 +67,172 @@ namespace PGBE
         m_prev_and_res = and_res;
         if (m_prev_tima == 0xFF && m_tima == 0x00)
         {
-            schedule_task(4, std::bind(&Timer::m_tima_overflow, this));
+            m_scheduler.schedule(t_cycle + 4, PHASE_TIMER, EVENT_TIMA_RELOAD);
         }
     }
 
-    void Timer::advance_cycle()
+    // Same as t_cycles calls to m_update_clock(), none of them may overflow TIMA
+    void Timer::m_count(u64 t_cycles)
     {
-        for (int i = 0; i < 4; ++i)
+        const int pos = m_tima_bit();
+
+        if (m_timer_enabled())
         {
-            m_update_clock();
-            m_check_timers();
-            m_ppu->tick();
+            // TIMA is bumped every time the bit at pos falls
+            const u64 period = 2 << pos;
+            const u64 edges = (m_internal_div + t_cycles) / period - m_internal_div / period;
+
+            if (edges > 0)
+            {
+                m_tima += (u8)edges;
+                m_prev_tima = m_tima - 1;
+            }
         }
+
+        m_internal_div += (u16)t_cycles;
+        m_div = ((m_internal_div & 0xFF00) >> 8);
+        m_prev_and_res = is_set_bit(m_internal_div, pos) && m_timer_enabled();
+        m_synced += t_cycles;
     }
 
-    bool Timer::m_timer_enabled()
+    // TAC or DIV changed since the last edge check, or TIMA reads 00 right after
+    // overflowing and a reload gets queued on every T-cycle
+    bool Timer::m_needs_ticking()
     {
-        return ((m_tac >> 2) & 0x01) > 0;
+        if (m_prev_tima == 0xFF && m_tima == 0x00)
+        {
+            return true;
+        }
+
+        return m_prev_and_res != (is_set_bit(m_internal_div, m_tima_bit()) && m_timer_enabled());
     }
 
-    void Timer::m_check_timers()
+    // T-cycles from m_synced to the one whose TIMA bump overflows
+    u64 Timer::m_overflow_distance()
     {
-        for (auto it = m_timers.begin(); it != m_timers.end();)
+        if (!m_timer_enabled())
         {
-            if (it->count++ >= it->delay)
+            return Scheduler::NEVER;
+        }
+
+        const u64 period = 2 << m_tima_bit();
+        const u64 first_edge = period - (m_internal_div % period);
+
+        return first_edge + (0xFF - m_tima) * period;
+    }
+
+    void Timer::sync()
+    {
+        while (m_synced < m_scheduler.now)
+        {
+            if (m_needs_ticking())
             {
-                it->callback();
-                it = m_timers.erase(it);
+                m_update_clock(++m_synced);
+                continue;
+            }
+
+            const u64 t_cycles = m_scheduler.now - m_synced;
+            const u64 overflow = m_overflow_distance();
+
+            if (overflow > t_cycles)
+            {
+                m_count(t_cycles);
             }
             else
             {
-                it++;
+                // The overflowing bump queues the reload
+                m_count(overflow - 1);
+                m_update_clock(++m_synced);
             }
         }
     }
 
+    void Timer::reschedule()
+    {
+        m_ticking = m_needs_ticking();
+        m_scheduler.cancel(EVENT_TIMA_OVERFLOW);
+
+        if (!m_ticking && m_timer_enabled())
+        {
+            m_scheduler.schedule(m_synced + m_overflow_distance(), PHASE_TIMER, EVENT_TIMA_OVERFLOW);
+        }
+    }
+
+    void Timer::advance_cycle()
+    {
+        const u64 end = m_scheduler.now + 4;
+
+        // Handlers see now as the T-cycle of their event
+        event e;
+        while (m_scheduler.pop_due(end, e))
+        {
+            m_scheduler.now = Scheduler::t_cycle_of(e);
+            m_run_event(e);
+        }
+
+        m_scheduler.now = end;
+
+        // Reloads are queued 4 T-cycles ahead, catching up once per M-cycle is soon enough
+        if (m_ticking)
+        {
+            sync();
+            reschedule();
+        }
+    }
+
+    u64 Timer::idle_cycles()
+    {
+        if (m_ticking)
+        {
+            return 0;
+        }
+
+        // TIMA overflows, PPU modes and STAT checks are all events
+        const u64 next = m_scheduler.next();
+        if (next == Scheduler::NEVER)
+        {
+            return Scheduler::NEVER / 4;
+        }
+
+        return ((next > m_scheduler.now) ? next - m_scheduler.now - 1 : 0) / 4;
+    }
+
+    void Timer::skip(u64 m_cycles)
+    {
+        // DIV and TIMA catch up on their next access
+        m_scheduler.now += m_cycles * 4;
+    }
+
+    bool Timer::m_timer_enabled()
+    {
+        return ((m_tac >> 2) & 0x01) > 0;
+    }
+
+    void Timer::m_run_event(const event& e)
+    {
+        switch (e.type)
+        {
+        case EVENT_TIMA_OVERFLOW:
+            sync();
+            reschedule();
+            break;
+        case EVENT_TIMA_RELOAD:
+            sync();
+            m_tima_overflow();
+            reschedule();
+            break;
+        case EVENT_OAM_DMA:
+            m_mmu->oam_dma_transfer(e.payload);
+            break;
+        case EVENT_PPU_MODE:
+            m_ppu->next_mode();
+            break;
+        case EVENT_PPU_STAT:
+            m_ppu->check_lcd();
+            break;
+        }
+    }
+
     void Timer::m_tima_overflow()
     {
         set_bit(m_IF, 2);
@@ -103,6 +245,9 @@ namespace PGBE
         // m_internal_div = 0;
         // m_prev_and_res = false;
         // m_prev_tima = 0;
-        m_timers.clear();
+        m_scheduler.cancel(EVENT_TIMA_RELOAD);
+        m_scheduler.cancel(EVENT_OAM_DMA);
+        m_synced = m_scheduler.now;
+        reschedule();
     }
 }
\ No newline at end of file
@@ -1,28 +1,39 @@
 #pragma once
 #include "MMU.h"
 #include "PPU.h"
-#include <functional>
+#include "Scheduler.h"
 
 namespace PGBE
 {
-    struct Task
-    {
-        int count;
-        int delay;
-        std::function<void()> callback;
-    };
-    
     class Timer
     {
     public:
         Timer(MMU* mmu, PPU* ppu);
         
-        void schedule_task(int delay, std::function<void()> callback);
+        // Runs the events scheduled over the next 4 T-cycles
         void advance_cycle();
         void reset();
+
+        // Counts DIV and TIMA up to the current T-cycle, they are only brought up to date when accessed
+        void sync();
+        // Finds when TIMA overflows next, to call after DIV, TIMA, TMA or TAC changed
+        void reschedule();
+
+        // M-cycles before the one running the next event
+        u64 idle_cycles();
+        // Same as calling advance_cycle() m_cycles times, m_cycles must not exceed idle_cycles()
+        void skip(u64 m_cycles);
+
+        // DIV, TIMA and the pending TIMA events are saved with the MMU
+        void save_state(StateWriter& w);
+        void load_state(StateReader& r);
     private:
-        void m_update_clock();
-        void m_check_timers();
+        void m_update_clock(u64 t_cycle);
+        void m_count(u64 t_cycles);
+        bool m_needs_ticking();
+        u64 m_overflow_distance();
+        int m_tima_bit();
+        void m_run_event(const event& e);
         bool m_timer_enabled();
 
         void m_tima_overflow();
@@ -31,8 +42,10 @@ namespace PGBE
         PPU* m_ppu;
         u16& m_internal_div;
         u8& m_div, &m_tima, &m_tma, &m_tac, &m_IF;
+        Scheduler& m_scheduler;
         bool m_prev_and_res;
         u8 m_prev_tima;
-        std::vector<Task> m_timers;
+        u64 m_synced; // T-cycle DIV and TIMA are counted up to
+        bool m_ticking; // counted on every T-cycle, see m_needs_ticking()
     };
 }
\ No newline at end of file
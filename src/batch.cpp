@@ -0,0 +1,247 @@
+#include "Emulator.h"
+#include "integers.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <fmt/core.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Runs many independent instances of a rom on every core and reports the aggregate speed.
+// Usage : pgbe-batch --rom=<path> [--instances=N] [--frames=N] [--threads=N] [--chunk=N] [--pin] [--no-render]
+// Each instance is stepped by chunks of frames. A worker keeps running the instances it
+// started and steals a chunk from another worker when it runs out of them.
+
+using namespace std::chrono;
+
+struct options
+{
+    std::string rom;
+    int instances = 0;
+    int threads = 0;
+    u64 frames = 600;
+    u64 chunk = 60;
+    bool pin = false;
+    bool render = true;
+};
+
+// Instances waiting for their next chunk. The owner works from the front, thieves take the back.
+struct work_queue
+{
+    std::mutex mutex;
+    std::deque<int> instances;
+
+    void push(int i)
+    {
+        std::lock_guard lock(mutex);
+        instances.push_front(i);
+    }
+
+    std::optional<int> pop()
+    {
+        std::lock_guard lock(mutex);
+        if (instances.empty())
+        {
+            return std::nullopt;
+        }
+
+        int i = instances.front();
+        instances.pop_front();
+        return i;
+    }
+
+    std::optional<int> steal()
+    {
+        std::lock_guard lock(mutex);
+        if (instances.empty())
+        {
+            return std::nullopt;
+        }
+
+        int i = instances.back();
+        instances.pop_back();
+        return i;
+    }
+};
+
+struct instance
+{
+    PGBE::Emulator emulator;
+    u64 frames = 0;
+};
+
+static bool parse_args(int argc, char* argv[], options& opt)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        const auto eq = arg.find('=');
+        const auto key = arg.substr(0, eq);
+        const std::string value{(eq == std::string_view::npos) ? std::string_view{} : arg.substr(eq + 1)};
+
+        if (key == "--rom")
+        {
+            opt.rom = value;
+        }
+        else if (key == "--instances")
+        {
+            opt.instances = std::atoi(value.c_str());
+        }
+        else if (key == "--threads")
+        {
+            opt.threads = std::atoi(value.c_str());
+        }
+        else if (key == "--frames")
+        {
+            opt.frames = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (key == "--chunk")
+        {
+            opt.chunk = std::max<u64>(1, std::strtoull(value.c_str(), nullptr, 10));
+        }
+        else if (key == "--pin")
+        {
+            opt.pin = true;
+        }
+        else if (key == "--no-render")
+        {
+            opt.render = false;
+        }
+        else
+        {
+            fmt::print("Unknown argument {}...\n", arg);
+            return false;
+        }
+    }
+
+    return !opt.rom.empty();
+}
+
+static void pin_to_core(std::thread& t, int core)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+
+    if (pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) != 0)
+    {
+        fmt::print("Can't pin a worker to core {}...\n", core);
+    }
+#else
+    fmt::print("Pinning is only supported on Linux...\n");
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    options opt;
+    if (!parse_args(argc, argv, opt))
+    {
+        fmt::print("Usage : pgbe-batch --rom=<path> [--instances=N] [--frames=N] [--threads=N] [--chunk=N] [--pin] [--no-render]\n");
+        return 1;
+    }
+
+    const int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+    const int nb_threads = (opt.threads > 0) ? opt.threads : cores;
+    const int nb_instances = (opt.instances > 0) ? opt.instances : nb_threads;
+
+    // Every instance maps the same rom image
+    std::vector<std::unique_ptr<instance>> instances;
+    for (int i = 0; i < nb_instances; ++i)
+    {
+        instances.push_back(std::make_unique<instance>());
+        if (!instances.back()->emulator.load_rom_file(opt.rom))
+        {
+            return 1;
+        }
+    }
+
+    std::vector<work_queue> queues(nb_threads);
+    for (int i = 0; i < nb_instances; ++i)
+    {
+        queues[i % nb_threads].push(i);
+    }
+
+    std::atomic<int> unfinished = nb_instances;
+
+    auto worker = [&](int id)
+    {
+        while (unfinished.load(std::memory_order_acquire) > 0)
+        {
+            auto i = queues[id].pop();
+            for (int k = 1; !i && k < nb_threads; ++k)
+            {
+                i = queues[(id + k) % nb_threads].steal();
+            }
+
+            if (!i)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            auto& inst = *instances[*i];
+            const u64 end = std::min(inst.frames + opt.chunk, opt.frames);
+            for (; inst.frames < end; ++inst.frames)
+            {
+                inst.emulator.run_frame(opt.render);
+            }
+
+            if (inst.frames < opt.frames)
+            {
+                queues[id].push(*i);
+            }
+            else
+            {
+                unfinished.fetch_sub(1, std::memory_order_release);
+            }
+        }
+    };
+
+    const auto start = steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int id = 0; id < nb_threads; ++id)
+    {
+        threads.emplace_back(worker, id);
+        if (opt.pin)
+        {
+            pin_to_core(threads.back(), id % cores);
+        }
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+    const u64 total_frames = (u64)nb_instances * opt.frames;
+
+    u64 total_cycles = 0;
+    u64 total_instrs = 0;
+    for (const auto& inst : instances)
+    {
+        total_cycles += inst->emulator.cycles();
+        total_instrs += inst->emulator.instructions();
+    }
+
+    fmt::print("{} instances x {} frames on {} threads in {:.3f} s\n", nb_instances, opt.frames, nb_threads, elapsed);
+    fmt::print("{:.1f} frames/s, {:.1f} frames/s per thread, {:.2f} M-cycles/s, {:.2f} MIPS\n",
+        total_frames / elapsed, total_frames / elapsed / nb_threads, total_cycles / elapsed / 1'000'000, total_instrs / elapsed / 1'000'000);
+
+    return 0;
+}
\ No newline at end of file
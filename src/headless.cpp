@@ -0,0 +1,239 @@
+#include "GameBoy.h"
+#include "integers.h"
+#include "Movie.h"
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Runs a rom without window nor audio, as fast as the host allows.
+// Usage : pgbe-headless --rom=<path> [--frames=N | --cycles=N] [--boot=<path>]
+//                       [--dump-frame=<path.ppm>] [--dump-serial=<path>] [--keep-save]
+//                       [--load-state=<path>] [--save-state=<path>] [--movie=<path>] [--no-render]
+// Without a boot rom the cartridge starts at 0x0100 in the post boot state.
+// Battery RAM is only written to the .sav file with --keep-save.
+// --cycles counts M-cycles. --headless is accepted for the older test scripts.
+// A loaded state replaces the power on state, the state after the run can be saved.
+// A movie replays its inputs from the state it starts from, for its length unless --frames is given.
+// The hash of the final state is printed, equal runs give the same one.
+// --no-render runs the frames without drawing them, the hash doesn't change.
+
+using namespace std::chrono;
+
+struct options
+{
+    std::string rom;
+    std::string boot;
+    std::string frame_path;
+    std::string serial_path;
+    std::string load_state_path;
+    std::string save_state_path;
+    std::string movie_path;
+    u64 frames = 0;
+    u64 cycles = 0;
+    bool keep_save = false;
+    bool render = true;
+};
+
+static bool parse_args(int argc, char* argv[], options& opt)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        const auto eq = arg.find('=');
+        const auto key = arg.substr(0, eq);
+        const auto value = (eq == std::string_view::npos) ? std::string_view{} : arg.substr(eq + 1);
+
+        if (key == "--rom")
+        {
+            opt.rom = value;
+        }
+        else if (key == "--boot")
+        {
+            opt.boot = value;
+        }
+        else if (key == "--frames")
+        {
+            opt.frames = std::strtoull(std::string{value}.c_str(), nullptr, 10);
+        }
+        else if (key == "--cycles")
+        {
+            opt.cycles = std::strtoull(std::string{value}.c_str(), nullptr, 10);
+        }
+        else if (key == "--dump-frame")
+        {
+            opt.frame_path = value;
+        }
+        else if (key == "--dump-serial")
+        {
+            opt.serial_path = value;
+        }
+        else if (key == "--load-state")
+        {
+            opt.load_state_path = value;
+        }
+        else if (key == "--save-state")
+        {
+            opt.save_state_path = value;
+        }
+        else if (key == "--movie")
+        {
+            opt.movie_path = value;
+        }
+        else if (key == "--keep-save")
+        {
+            opt.keep_save = true;
+        }
+        else if (key == "--no-render")
+        {
+            opt.render = false;
+        }
+        else if (key != "--headless")
+        {
+            fmt::print("Unknown argument {}...\n", arg);
+            return false;
+        }
+    }
+
+    return !opt.rom.empty();
+}
+
+static void write_ppm(const std::string& path, const std::array<PGBE::color, FRAMEBUFFER_SIZE>& framebuffer)
+{
+    std::ofstream output(path, std::ios::binary);
+    output << "P6\n" << GB_VIEWPORT_WIDTH << " " << GB_VIEWPORT_HEIGHT << "\n255\n";
+
+    for (const auto& c : framebuffer)
+    {
+        output.put((char)c.r).put((char)c.g).put((char)c.b);
+    }
+
+    if (!output)
+    {
+        fmt::print("Can't write {}...\n", path);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    options opt;
+    if (!parse_args(argc, argv, opt))
+    {
+        fmt::print("Usage : pgbe-headless --rom=<path> [--frames=N | --cycles=N] [--boot=<path>] [--dump-frame=<path.ppm>] [--dump-serial=<path>] [--keep-save] [--load-state=<path>] [--save-state=<path>] [--movie=<path>] [--no-render]\n");
+        return 1;
+    }
+
+    auto gb = std::make_unique<PGBE::GameBoy>();
+    auto framebuffer = std::make_unique<std::array<PGBE::color, FRAMEBUFFER_SIZE>>();
+    std::string serial;
+
+    gb->ppu.framebuffer = framebuffer.get();
+    gb->mmu.serial_log = &serial;
+    // Deterministic, whatever the host speed
+    gb->mmu.rtc_mode = PGBE::RTC_EMULATED_CLOCK;
+
+    if (!gb->mmu.load_game_rom(opt.rom, opt.keep_save))
+    {
+        return 1;
+    }
+
+    if (opt.boot.empty())
+    {
+        gb->skip_boot_rom();
+    }
+    else
+    {
+        gb->mmu.load_boot_rom(opt.boot);
+    }
+
+    if (!opt.load_state_path.empty())
+    {
+        std::ifstream input(opt.load_state_path, std::ios::binary);
+        std::vector<u8> state((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        if (!input || !gb->load_state(state))
+        {
+            fmt::print("Can't load state {}...\n", opt.load_state_path);
+            return 1;
+        }
+    }
+
+    PGBE::Movie movie;
+    if (!opt.movie_path.empty())
+    {
+        if (!movie.load(opt.movie_path) || !movie.start_replay(*gb))
+        {
+            fmt::print("Can't play movie {}...\n", opt.movie_path);
+            return 1;
+        }
+
+        if (opt.frames == 0)
+        {
+            opt.frames = movie.length();
+        }
+    }
+    else if (opt.frames == 0)
+    {
+        opt.frames = 600;
+    }
+
+    u64 frames = 0;
+    const u64 start_cycles = gb->cpu.cycles();
+    const u64 start_instrs = gb->cpu.instructions();
+    const auto start = steady_clock::now();
+
+    if (opt.cycles > 0 && opt.movie_path.empty())
+    {
+        frames = gb->run_cycles(opt.cycles, opt.render);
+    }
+    else
+    {
+        for (; frames < opt.frames; ++frames)
+        {
+            movie.apply(*gb);
+            gb->run_frame(opt.render);
+            movie.frame_completed();
+        }
+    }
+
+    const double elapsed = duration<double>(steady_clock::now() - start).count();
+    const u64 cycles = gb->cpu.cycles() - start_cycles;
+    const u64 instrs = gb->cpu.instructions() - start_instrs;
+
+    fmt::print("{} frames, {} M-cycles, {} instructions in {:.3f} s\n", frames, cycles, instrs, elapsed);
+    fmt::print("{:.1f} frames/s, {:.2f} M-cycles/s, {:.2f} MIPS ({:.1f}x real time)\n",
+        frames / elapsed, cycles / elapsed / 1'000'000, instrs / elapsed / 1'000'000, (cycles * 4.0 / FREQUENCY) / elapsed);
+    fmt::print("State hash {:016x}{}\n", gb->state_hash(), movie.desynced() ? " (movie desynced)" : "");
+
+    if (!opt.frame_path.empty())
+    {
+        write_ppm(opt.frame_path, *framebuffer);
+    }
+
+    if (!opt.serial_path.empty())
+    {
+        std::ofstream output(opt.serial_path, std::ios::binary);
+        output << serial;
+    }
+
+    if (!opt.save_state_path.empty())
+    {
+        std::vector<u8> state(gb->state_size());
+        gb->save_state(state);
+
+        std::ofstream output(opt.save_state_path, std::ios::binary);
+        output.write(reinterpret_cast<const char*>(state.data()), state.size());
+        if (!output)
+        {
+            fmt::print("Can't write {}...\n", opt.save_state_path);
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -3,10 +3,15 @@
 #include "imgui_impl_sdlrenderer.h"
 #include "imgui.h"
 #include "integers.h"
+#include "Movie.h"
+#include "Rewind.h"
 #include <bit>
 #include <chrono>
+#include <filesystem>
 #include <memory>
 #include <SDL.h>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -21,9 +26,46 @@ constexpr auto WINDOW_HEIGHT = 720;
 
 constexpr auto BOOT_ROM_PATH = "DMG_ROM.bin";
 
+// Well over a minute of most games, stepped back through at twice the speed it was played
+constexpr auto REWIND_BUFFER_SIZE = 16 * 1024 * 1024;
+constexpr auto REWIND_INTERVAL = 2; // frames
+constexpr auto REWIND_KEY = SDLK_BACKSPACE;
+
+// Frames run ahead of the one shown, each one hides a frame of the game's input lag
+constexpr auto MAX_RUN_AHEAD = 4;
+
+// Held down, runs the game at fast_forward_speed times its speed, 0 as fast as the host allows
+constexpr auto FAST_FORWARD_KEY = SDLK_TAB;
+
+// The movie of a rom is kept next to it
+constexpr auto MOVIE_RECORD_KEY = SDLK_F5;
+constexpr auto MOVIE_PLAY_KEY = SDLK_F6;
+constexpr auto MOVIE_EXTENSION = ".pgbm";
+
 double frametime = 0;
+double rewind_time = 0;
+double run_ahead_time = 0;
+bool rewinding = false;
+int run_ahead = 0;
+bool fast_forwarding = false;
+int fast_forward_speed = 0;
+int frames_skipped = 0;
+double present_time = 0; // ms to draw and show a frame
+
+// Frames drawn but not shown while running ahead
+std::array<PGBE::color, FRAMEBUFFER_SIZE> hidden_frame;
+std::vector<u8> run_ahead_state;
 
 PGBE::GameBoy gb;
+PGBE::Rewind history(&gb, REWIND_BUFFER_SIZE, REWIND_INTERVAL);
+PGBE::Movie movie;
+std::string rom_path;
+
+struct GB_MAP
+{
+    PGBE::GB_BUTTON b;
+    SDL_Keycode k;
+};
 
 static void perf_window()
 {
@@ -32,6 +74,30 @@ static void perf_window()
     ImGui::Begin("Perf Info");
     ImGui::Text("Total Frametime: %.3f ms (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
     ImGui::Text("GB Frametime: %.2f ms", frametime);
+    ImGui::Text("Rewind: %.1f s in %.2f MB (%.3f ms)", history.seconds(), history.used() / (1024.0 * 1024.0), rewind_time);
+    ImGui::SliderInt("Run-ahead", &run_ahead, 0, MAX_RUN_AHEAD);
+    ImGui::Text("Run-ahead cost: %.2f ms", run_ahead_time);
+    ImGui::Text("Fast-forward:");
+    ImGui::SameLine();
+    ImGui::RadioButton("2x", &fast_forward_speed, 2);
+    ImGui::SameLine();
+    ImGui::RadioButton("4x", &fast_forward_speed, 4);
+    ImGui::SameLine();
+    ImGui::RadioButton("Unlimited", &fast_forward_speed, 0);
+    ImGui::Text("Frames skipped: %d", frames_skipped);
+
+    switch (movie.mode())
+    {
+    case PGBE::MOVIE_RECORDING:
+        ImGui::Text("Movie: recording frame %llu", (unsigned long long)movie.frame());
+        break;
+    case PGBE::MOVIE_PLAYING:
+        ImGui::Text("Movie: playing frame %llu / %llu%s", (unsigned long long)movie.frame(), (unsigned long long)movie.length(), movie.desynced() ? " (desynced)" : "");
+        break;
+    default:
+        ImGui::Text("Movie: F5 records, F6 plays");
+        break;
+    }
     ImGui::End();
 }
 
@@ -98,15 +164,126 @@ static void nsleep(u64 nanoseconds)
 #endif
 }
 
+// Shows the frame run_ahead frames later with the current input, then goes back to the real one
+static void on_run_ahead(std::array<PGBE::color, FRAMEBUFFER_SIZE>* screen)
+{
+    auto start = high_resolution_clock::now();
+
+    // Only reallocated when the cartridge changes
+    run_ahead_state.resize(gb.state_size());
+    gb.save_state(run_ahead_state, false);
+
+    for (int i = 1; i < run_ahead; ++i)
+    {
+        gb.run_frame(false);
+    }
+
+    gb.ppu.framebuffer = screen;
+    gb.run_frame();
+
+    // The screen keeps the frame ahead
+    gb.load_state(run_ahead_state);
+    gb.ppu.framebuffer = &hidden_frame;
+
+    run_ahead_time = duration_cast<microseconds>(high_resolution_clock::now() - start) / 1.0ms;
+}
+
+static std::string movie_path()
+{
+    return std::filesystem::path(rom_path).replace_extension(MOVIE_EXTENSION).string();
+}
+
+static void on_movie_record()
+{
+    if (movie.mode() == PGBE::MOVIE_RECORDING)
+    {
+        movie.stop();
+        movie.save(movie_path());
+        SDL_Log("Movie of %llu frames recorded, state hash %016llx", (unsigned long long)movie.length(), (unsigned long long)gb.state_hash());
+    }
+    else if (movie.mode() == PGBE::MOVIE_STOPPED && !rom_path.empty())
+    {
+        movie.start_recording(gb);
+    }
+}
+
+static void on_movie_play()
+{
+    if (movie.mode() == PGBE::MOVIE_PLAYING)
+    {
+        movie.stop();
+    }
+    else if (movie.mode() == PGBE::MOVIE_STOPPED && !rom_path.empty())
+    {
+        // The history is of another timeline
+        if (movie.load(movie_path()) && movie.start_replay(gb))
+        {
+            history.clear();
+        }
+    }
+}
+
+// A frame of the game, only drawn when shown
+static void run_game_frame(bool render)
+{
+    const bool playing = movie.mode() == PGBE::MOVIE_PLAYING;
+
+    movie.apply(gb);
+    gb.run_frame(render);
+    movie.frame_completed();
+
+    if (playing && movie.mode() == PGBE::MOVIE_STOPPED)
+    {
+        SDL_Log("Movie played, state hash %016llx", (unsigned long long)gb.state_hash());
+    }
+
+    auto start = high_resolution_clock::now();
+    history.frame_completed();
+    rewind_time = duration_cast<microseconds>(high_resolution_clock::now() - start) / 1.0ms;
+}
+
+// Runs the frames skipped before the next one shown : fast_forward_speed - 1 of them, or as many
+// as fit before the next one is due. They are neither drawn nor uploaded, and have no GUI frame.
+static void on_fast_forward(high_resolution_clock::time_point start)
+{
+    const auto due = start + nanoseconds(FRAME_DURATION_NS) - duration_cast<nanoseconds>(present_time * 1.0ms);
+
+    frames_skipped = 0;
+    while ((fast_forward_speed > 0) ? frames_skipped < fast_forward_speed - 1 : high_resolution_clock::now() < due)
+    {
+        run_game_frame(false);
+        ++frames_skipped;
+    }
+}
+
 static void on_update(SDL_Texture* texture)
 {
     u8 *pixels;
     int pitch;
     SDL_LockTexture(texture, nullptr, (void **)&pixels, &pitch);
-    gb.ppu.framebuffer = std::bit_cast<std::array<PGBE::color, FRAMEBUFFER_SIZE>*>(pixels);
-    while (!gb.ppu.frame_completed())
+    auto screen = std::bit_cast<std::array<PGBE::color, FRAMEBUFFER_SIZE>*>(pixels);
+
+    // The real frame is only drawn to the screen without run-ahead
+    gb.ppu.framebuffer = (run_ahead > 0 && !rewinding) ? &hidden_frame : screen;
+
+    if (rewinding)
     {
-        gb.cpu.run();
+        // Stays on the oldest state once the history is exhausted
+        history.step_back();
+    }
+    else
+    {
+        // With run-ahead the screen shows a frame ahead of this one
+        run_game_frame(run_ahead == 0);
+
+        if (run_ahead > 0)
+        {
+            on_run_ahead(screen);
+        }
+        else
+        {
+            run_ahead_time = 0;
+        }
     }
 
     SDL_UnlockTexture(texture);
@@ -133,8 +310,6 @@ static void on_render(SDL_Renderer* renderer, SDL_Texture* texture, SDL_Rect* re
 
     ImGui_ImplSDLRenderer_RenderDrawData(ImGui::GetDrawData());
     SDL_RenderPresent(renderer);
-
-    gb.ppu.reset();
 }
 
 static void on_resize(SDL_Window* window, SDL_Rect* rect_lcd)
@@ -158,16 +333,49 @@ static void on_resize(SDL_Window* window, SDL_Rect* rect_lcd)
 
 static void handle_keypress(const SDL_Keycode keycode, const bool pressed)
 {
-    constexpr std::array<PGBE::GB_MAP, PGBE::BUTTON_ENUM_SIZE> keymapping_array =
+    // A movie is a single timeline
+    if (keycode == REWIND_KEY)
     {
-        PGBE::GB_MAP{ .b = PGBE::GB_UP, .k = SDLK_UP },
-        PGBE::GB_MAP{ .b = PGBE::GB_DOWN, .k = SDLK_DOWN },
-        PGBE::GB_MAP{ .b = PGBE::GB_LEFT, .k = SDLK_LEFT },
-        PGBE::GB_MAP{ .b = PGBE::GB_RIGHT, .k = SDLK_RIGHT },
-        PGBE::GB_MAP{ .b = PGBE::GB_A, .k = SDLK_a },
-        PGBE::GB_MAP{ .b = PGBE::GB_B, .k = SDLK_s },
-        PGBE::GB_MAP{ .b = PGBE::GB_START, .k = SDLK_z },
-        PGBE::GB_MAP{ .b = PGBE::GB_SELECT, .k = SDLK_x },
+        rewinding = pressed && movie.mode() == PGBE::MOVIE_STOPPED;
+        return;
+    }
+
+    if (keycode == FAST_FORWARD_KEY)
+    {
+        fast_forwarding = pressed;
+        frames_skipped = 0;
+        return;
+    }
+
+    if (keycode == MOVIE_RECORD_KEY || keycode == MOVIE_PLAY_KEY)
+    {
+        if (pressed && keycode == MOVIE_RECORD_KEY)
+        {
+            on_movie_record();
+        }
+        else if (pressed)
+        {
+            on_movie_play();
+        }
+        return;
+    }
+
+    // The movie gives the buttons while it plays
+    if (movie.mode() == PGBE::MOVIE_PLAYING)
+    {
+        return;
+    }
+
+    constexpr std::array<GB_MAP, PGBE::BUTTON_ENUM_SIZE> keymapping_array =
+    {
+        GB_MAP{ .b = PGBE::GB_UP, .k = SDLK_UP },
+        GB_MAP{ .b = PGBE::GB_DOWN, .k = SDLK_DOWN },
+        GB_MAP{ .b = PGBE::GB_LEFT, .k = SDLK_LEFT },
+        GB_MAP{ .b = PGBE::GB_RIGHT, .k = SDLK_RIGHT },
+        GB_MAP{ .b = PGBE::GB_A, .k = SDLK_a },
+        GB_MAP{ .b = PGBE::GB_B, .k = SDLK_s },
+        GB_MAP{ .b = PGBE::GB_START, .k = SDLK_z },
+        GB_MAP{ .b = PGBE::GB_SELECT, .k = SDLK_x },
     };
 
     for (auto cur : keymapping_array)
@@ -175,6 +383,7 @@ static void handle_keypress(const SDL_Keycode keycode, const bool pressed)
         if (cur.k == keycode)
         {
             gb.use_button(cur.b, pressed);
+            movie.record(gb, cur.b, pressed);
             return;
         }
     }
@@ -237,6 +446,9 @@ int main(int argc, char* argv[])
             case SDL_DROPFILE:
                 gb.reset();
                 gb.mmu.load_game_rom(e.drop.file);
+                history.clear();
+                movie.stop();
+                rom_path = e.drop.file;
                 SDL_free(e.drop.file);
                 break;
             case SDL_WINDOWEVENT:
@@ -246,15 +458,27 @@ int main(int argc, char* argv[])
                 handle_keypress(e.key.keysym.sym, false);
                 break;
             case SDL_KEYDOWN:
-                handle_keypress(e.key.keysym.sym, true);
+                // A key held down toggles once
+                if (e.key.repeat == 0)
+                {
+                    handle_keypress(e.key.keysym.sym, true);
+                }
                 break;
             }
         }
 
+        if (fast_forwarding && !rewinding)
+        {
+            on_fast_forward(start);
+        }
+
+        auto shown = high_resolution_clock::now();
         on_update(lcd_texture);
         on_render(renderer, lcd_texture, &lcd_rect);
         auto end = high_resolution_clock::now();
 
+        present_time = duration_cast<microseconds>(end - shown) / 1.0ms;
+
         frametime = duration_cast<microseconds>(end - start) / 1.0ms;
         auto sleep_time = (nanoseconds(FRAME_DURATION_NS) - duration_cast<nanoseconds>(end - start)).count();
 
@@ -1,10 +1,24 @@
+import os
 import subprocess
 
-PGBE_path = "C:\\Users\\David\\Documents\\Dev\\PGBE\\builddir\\PGBE.exe"
-PGBE_args = "--headless --rom={my_rom}"
+import pytest
 
-def test_blarggs_cpu_instrs():
-    rom_path = "test-roms\\blargg's-gb-tests\\cpu_instrs\\cpu_instrs.gb"
-    
-    output = subprocess.Popen([PGBE_path, PGBE_args.format(my_rom = rom_path)])
-    assert False
\ No newline at end of file
+PGBE_path = os.environ.get("PGBE_HEADLESS", "builddir/pgbe-headless")
+
+ROM_prefix = "tests/rom/blargg/"
+
+# Frames each rom needs to print its result over the serial port
+ROMs = {
+    "cpu_instrs/cpu_instrs.gb": 4000,
+    "instr_timing/instr_timing.gb": 500,
+    "mem_timing/mem_timing.gb": 500,
+}
+
+@pytest.mark.parametrize("rom", ROMs)
+def test_blargg(rom, tmp_path):
+    serial_path = tmp_path / "serial.txt"
+    subprocess.run([PGBE_path, "--rom=" + ROM_prefix + rom, "--frames=" + str(ROMs[rom]), "--no-render",
+        "--dump-serial=" + str(serial_path)], check=True, capture_output=True)
+
+    serial = serial_path.read_text(errors="replace")
+    assert "Passed" in serial and "Failed" not in serial
\ No newline at end of file
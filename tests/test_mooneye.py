@@ -1,12 +1,77 @@
+import os
 import subprocess
 
-PGBE_path = "builddir/PGBE"
-PGBE_args = "--headless --rom={my_rom}"
+import pytest
 
-ROM_prefix = "tests/rom/mooneye"
+PGBE_path = os.environ.get("PGBE_HEADLESS", "builddir/pgbe-headless")
 
-def test_blarggs_cpu_instrs():
-    rom_path = ROM_prefix + "aceptance/add_sp_e_timing.gb"
-    
-    output = subprocess.Popen([PGBE_path, PGBE_args.format(my_rom = rom_path)])
-    assert False
\ No newline at end of file
+ROM_prefix = "tests/rom/mooneye/"
+
+# Passing tests load 3 5 8 13 21 34 into B C D E H L and send them over the serial port
+PASS_signature = bytes([0x03, 0x05, 0x08, 0x0D, 0x15, 0x22])
+
+# The ones PGBE passes
+ROMs = [
+    "acceptance/bits/mem_oam.gb",
+    "acceptance/bits/reg_f.gb",
+    "acceptance/boot_regs-dmgABC.gb",
+    "acceptance/div_timing.gb",
+    "acceptance/ei_sequence.gb",
+    "acceptance/ei_timing.gb",
+    "acceptance/halt_ime0_ei.gb",
+    "acceptance/halt_ime0_nointr_timing.gb",
+    "acceptance/halt_ime1_timing.gb",
+    "acceptance/instr/daa.gb",
+    "acceptance/intr_timing.gb",
+    "acceptance/oam_dma/basic.gb",
+    "acceptance/oam_dma/reg_read.gb",
+    "acceptance/pop_timing.gb",
+    "acceptance/ppu/intr_2_mode3_timing.gb",
+    "acceptance/rapid_di_ei.gb",
+    "acceptance/reti_intr_timing.gb",
+    "acceptance/timer/div_write.gb",
+    "acceptance/timer/tim00.gb",
+    "acceptance/timer/tim00_div_trigger.gb",
+    "acceptance/timer/tim01.gb",
+    "acceptance/timer/tim01_div_trigger.gb",
+    "acceptance/timer/tim10.gb",
+    "acceptance/timer/tim10_div_trigger.gb",
+    "acceptance/timer/tim11.gb",
+    "acceptance/timer/tim11_div_trigger.gb",
+    "acceptance/timer/tima_reload.gb",
+    "acceptance/timer/tma_write_reloading.gb",
+    "emulator-only/mbc1/bits_bank1.gb",
+    "emulator-only/mbc1/bits_bank2.gb",
+    "emulator-only/mbc1/bits_mode.gb",
+    "emulator-only/mbc1/bits_ramg.gb",
+    "emulator-only/mbc1/multicart_rom_8Mb.gb",
+    "emulator-only/mbc1/ram_256kb.gb",
+    "emulator-only/mbc1/ram_64kb.gb",
+    "emulator-only/mbc1/rom_16Mb.gb",
+    "emulator-only/mbc1/rom_1Mb.gb",
+    "emulator-only/mbc1/rom_2Mb.gb",
+    "emulator-only/mbc1/rom_4Mb.gb",
+    "emulator-only/mbc1/rom_512kb.gb",
+    "emulator-only/mbc1/rom_8Mb.gb",
+    "emulator-only/mbc2/bits_ramg.gb",
+    "emulator-only/mbc2/bits_romb.gb",
+    "emulator-only/mbc2/bits_unused.gb",
+    "emulator-only/mbc2/ram.gb",
+    "emulator-only/mbc2/rom_1Mb.gb",
+    "emulator-only/mbc2/rom_2Mb.gb",
+    "emulator-only/mbc2/rom_512kb.gb",
+    "emulator-only/mbc5/rom_16Mb.gb",
+    "emulator-only/mbc5/rom_1Mb.gb",
+    "emulator-only/mbc5/rom_2Mb.gb",
+    "emulator-only/mbc5/rom_4Mb.gb",
+    "emulator-only/mbc5/rom_512kb.gb",
+    "emulator-only/mbc5/rom_8Mb.gb",
+]
+
+@pytest.mark.parametrize("rom", ROMs)
+def test_mooneye(rom, tmp_path):
+    serial_path = tmp_path / "serial.bin"
+    subprocess.run([PGBE_path, "--rom=" + ROM_prefix + rom, "--frames=600", "--no-render",
+        "--dump-serial=" + str(serial_path)], check=True, capture_output=True)
+
+    assert serial_path.read_bytes()[:len(PASS_signature)] == PASS_signature
\ No newline at end of file
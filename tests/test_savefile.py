@@ -0,0 +1,30 @@
+import os
+import shutil
+import subprocess
+
+import pytest
+
+fcntl = pytest.importorskip("fcntl")
+
+PGBE_path = os.environ.get("PGBE_HEADLESS", "builddir/pgbe-headless")
+
+# MBC1 with battery-backed RAM
+ROM_path = "tests/rom/blargg/mem_timing-2/mem_timing.gb"
+
+def test_locked_save_is_left_alone(tmp_path):
+    rom_path = tmp_path / "bat.gb"
+    shutil.copy(ROM_path, rom_path)
+
+    save_path = tmp_path / "bat.sav"
+    save = bytes(range(256)) * 32
+    save_path.write_bytes(save)
+
+    # Another instance holds the .sav
+    with open(save_path, "rb") as other:
+        fcntl.flock(other, fcntl.LOCK_EX | fcntl.LOCK_NB)
+        output = subprocess.run([PGBE_path, "--rom=" + str(rom_path), "--frames=10", "--keep-save"],
+            capture_output=True, text=True)
+
+    assert output.returncode == 0
+    assert "already in use" in output.stdout
+    assert save_path.read_bytes() == save
\ No newline at end of file